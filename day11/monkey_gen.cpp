@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+// Worry levels are reduced modulo the LCD and may be squared, so the LCD must
+// stay small enough that LCD^2 fits in a signed 64 bit integer.
+constexpr int64_t MAX_LCD = INT32_MAX;
+
+// Upper bound for immediates in generated operations.
+constexpr int64_t MAX_IMM = 20;
+
+// Upper bound for generated starting worry levels.
+constexpr int64_t MAX_ITEM = 100;
+
+// Generator settings. Operation weights are relative, not percentages.
+struct Options {
+    size_t monkeys = 8;
+    size_t items = 4;
+    size_t add_weight = 4;
+    size_t mul_weight = 3;
+    size_t square_weight = 1;
+    int64_t max_divisor = 23;
+    uint64_t seed = 1;
+};
+
+void usage(const char* name) {
+    std::cerr << "Usage: " << name
+        << " [--monkeys N] [--items N] [--ops ADD,MUL,SQUARE]"
+        << " [--max-divisor N] [--seed N]" << std::endl;
+    exit(1);
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--monkeys") == 0) {
+            options.monkeys = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--items") == 0) {
+            options.items = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--ops") == 0) {
+            if (sscanf(argv[++i], "%zu,%zu,%zu",
+                    &options.add_weight, &options.mul_weight, &options.square_weight) != 3) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--max-divisor") == 0) {
+            options.max_divisor = static_cast<int64_t>(std::stol(argv[++i]));
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            options.seed = static_cast<uint64_t>(std::stoull(argv[++i]));
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (options.monkeys < 2 || options.items == 0 || options.max_divisor < 2
+        || options.add_weight + options.mul_weight + options.square_weight == 0) {
+        usage(argv[0]);
+    }
+    return options;
+}
+
+std::vector<int64_t> primesUpTo(int64_t limit) {
+    std::vector<int64_t> primes;
+    for (int64_t n = 2; n <= limit; ++n) {
+        bool prime = true;
+        for (int64_t p : primes) {
+            if (p * p > n) {
+                break;
+            }
+            if (n % p == 0) {
+                prime = false;
+                break;
+            }
+        }
+        if (prime) {
+            primes.push_back(n);
+        }
+    }
+    return primes;
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+    std::mt19937_64 rng(options.seed);
+
+    auto primes = primesUpTo(options.max_divisor);
+    std::uniform_int_distribution<size_t> prime_dist(0, primes.size() - 1);
+    std::uniform_int_distribution<int64_t> imm_dist(1, MAX_IMM);
+    std::uniform_int_distribution<int64_t> item_dist(1, MAX_ITEM);
+    std::uniform_int_distribution<size_t> op_dist(
+        0, options.add_weight + options.mul_weight + options.square_weight - 1);
+    std::uniform_int_distribution<size_t> target_dist(0, options.monkeys - 2);
+
+    int64_t lcd = 1;
+    for (size_t m = 0; m < options.monkeys; ++m) {
+        // Prefer a fresh prime, but fall back to one already in the LCD once
+        // another factor would overflow it.
+        int64_t divisor = primes[prime_dist(rng)];
+        if (lcd % divisor != 0 && lcd > MAX_LCD / divisor) {
+            divisor = 1;
+            for (int64_t p : primes) {
+                if (lcd % p == 0 && p > divisor) {
+                    divisor = p;
+                }
+            }
+        }
+        lcd = std::lcm(lcd, divisor);
+
+        std::string operation;
+        size_t op = op_dist(rng);
+        if (op < options.add_weight) {
+            operation = "old + " + std::to_string(imm_dist(rng));
+        } else if (op < options.add_weight + options.mul_weight) {
+            operation = "old * " + std::to_string(imm_dist(rng));
+        } else {
+            operation = "old * old";
+        }
+
+        // Monkeys never throw to themselves.
+        size_t true_cond = target_dist(rng);
+        size_t false_cond = target_dist(rng);
+        true_cond += (true_cond >= m);
+        false_cond += (false_cond >= m);
+
+        std::cout << "Monkey " << m << ":" << std::endl;
+        std::cout << "  Starting items: ";
+        for (size_t i = 0; i < options.items; ++i) {
+            std::cout << (i > 0 ? ", " : "") << item_dist(rng);
+        }
+        std::cout << std::endl;
+        std::cout << "  Operation: new = " << operation << std::endl;
+        std::cout << "  Test: divisible by " << divisor << std::endl;
+        std::cout << "    If true: throw to monkey " << true_cond << std::endl;
+        std::cout << "    If false: throw to monkey " << false_cond << std::endl;
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
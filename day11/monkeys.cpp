@@ -1,13 +1,21 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <numeric>
 #include <string>
 #include <vector>
 
-// Number of simulation rounds.
+#include <sys/resource.h>
+
+// Default number of simulation rounds.
 constexpr size_t NUM_ROUNDS = 10000;
 
+// Default rounds at which inspection counts are printed.
+constexpr auto DEFAULT_CHECKPOINTS = "1,20,1000,10000";
+
 // List item delimiter.
 constexpr auto LIST_DELIM = ", ";
 constexpr size_t LIST_DELIM_SIZE = 2;
@@ -179,6 +187,14 @@ void doRound(std::vector<Monkey>& monkies) {
     }
 }
 
+size_t totalInspections(const std::vector<Monkey>& monkies) {
+    size_t total = 0;
+    for (const auto& monkey : monkies) {
+        total += monkey.getInspectionCount();
+    }
+    return total;
+}
+
 void printInspectionCounts(size_t round, const std::vector<Monkey>& monkies) {
     std::cout << "== Round " << round << " ==" << std::endl;
     for (const auto& monkey : monkies) {
@@ -189,9 +205,75 @@ void printInspectionCounts(size_t round, const std::vector<Monkey>& monkies) {
     std::cout << std::endl;
 }
 
-int main() {
+// Command line options, used to drive benchmark runs.
+struct Options {
+    size_t rounds = NUM_ROUNDS;
+    std::vector<size_t> checkpoints;
+    bool stats = false;
+};
+
+std::vector<size_t> parseCheckpoints(const std::string& list) {
+    std::vector<size_t> checkpoints;
+    size_t begin = 0;
+    while (begin < list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > begin) {
+            checkpoints.push_back(static_cast<size_t>(std::stoul(list.substr(begin, end - begin))));
+        }
+        begin = end + 1;
+    }
+    std::sort(checkpoints.begin(), checkpoints.end());
+    checkpoints.erase(std::unique(checkpoints.begin(), checkpoints.end()), checkpoints.end());
+    return checkpoints;
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    options.checkpoints = parseCheckpoints(DEFAULT_CHECKPOINTS);
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            options.rounds = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--checkpoints") == 0 && i + 1 < argc) {
+            options.checkpoints = parseCheckpoints(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                << " [--rounds N] [--checkpoints R1,R2,...] [--stats] < input" << std::endl;
+            exit(1);
+        }
+    }
+
+    // Rounds are numbered from 1.
+    if (!options.checkpoints.empty() && options.checkpoints.front() == 0) {
+        std::cerr << "Checkpoints must be at least 1" << std::endl;
+        exit(1);
+    }
+    return options;
+}
+
+// Peak resident set size in kilobytes.
+long peakMemoryKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
     std::vector<Monkey> monkies;
 
+    auto phase_start = Clock::now();
     std::string line;
     while (std::getline(std::cin, line)) {
         // Skip blank lines.
@@ -207,14 +289,16 @@ int main() {
         }
         monkies.push_back(parseMonkey(monkey_name, input));
     }
+    double parse_ms = elapsedMs(phase_start);
 
     // Must have at least 2 monkies to calculate monkey business.
     assert(monkies.size() >= 2);
 
-    // Compute LCD for all monkies.
+    // Compute LCD for all monkies. Divisors may repeat in generated inputs, so
+    // take the least common multiple rather than the plain product.
     int64_t lcd = 1;
     for (const auto& monkey : monkies) {
-        lcd *= monkey.getTestCondition();
+        lcd = std::lcm(lcd, monkey.getTestCondition());
     }
 
     // Set LCD for all monkies.
@@ -222,12 +306,19 @@ int main() {
         monkey.setLCD(lcd);
     }
 
-    for (size_t round = 1; round <= NUM_ROUNDS; ++round) {
+    phase_start = Clock::now();
+    double report_ms = 0;
+    auto checkpoint = options.checkpoints.begin();
+    for (size_t round = 1; round <= options.rounds; ++round) {
         doRound(monkies);
-        if (round == 1 || round == 20 || round == 1000 || round == 10000) {
+        if (checkpoint != options.checkpoints.end() && round == *checkpoint) {
+            auto report_start = Clock::now();
             printInspectionCounts(round, monkies);
+            report_ms += elapsedMs(report_start);
+            ++checkpoint;
         }
     }
+    double simulate_ms = elapsedMs(phase_start) - report_ms;
 
     // Print results.
     std::vector<size_t> inspection_counts;
@@ -245,5 +336,20 @@ int main() {
 
     std::cout << "Monkey business: " << monkey_business << std::endl;
 
+    // Benchmark statistics go to stderr so the puzzle output stays comparable.
+    if (options.stats) {
+        size_t inspections = totalInspections(monkies);
+        std::cerr << "monkeys:         " << monkies.size() << std::endl;
+        std::cerr << "rounds:          " << options.rounds << std::endl;
+        std::cerr << "lcd:             " << lcd << std::endl;
+        std::cerr << "inspections:     " << inspections << std::endl;
+        std::cerr << "parse ms:        " << parse_ms << std::endl;
+        std::cerr << "simulate ms:     " << simulate_ms << std::endl;
+        std::cerr << "report ms:       " << report_ms << std::endl;
+        std::cerr << "inspections/sec: "
+            << (simulate_ms > 0 ? inspections / (simulate_ms / 1000.0) : 0) << std::endl;
+        std::cerr << "peak memory KB:  " << peakMemoryKB() << std::endl;
+    }
+
     return 0;
 }
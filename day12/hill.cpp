@@ -1,12 +1,21 @@
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <climits>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <queue>
+#include <stdexcept>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
+
 static const auto hash_int32 = std::hash<int32_t>{};
 
 struct Coordinate {
@@ -28,22 +37,139 @@ struct HashCoordinate {
     }
 };
 
+// Number of distinct terrain heights, 'a' through 'z'.
+constexpr size_t NUM_HEIGHTS = 26;
+
+// Height of the sentinel border around the map. Nothing can climb onto it.
+constexpr uint8_t BORDER_HEIGHT = UINT8_MAX;
+
+// Distance of a cell that has not been reached (yet).
+constexpr uint32_t UNVISITED = UINT32_MAX;
+
+// Distance of the sentinel border, which never counts as unvisited.
+constexpr uint32_t BORDER_DIST = UINT32_MAX - 1;
+
+using cell_t = uint32_t;
+
+// Closest cell of a given height to the end point.
+struct NearestCell {
+    Coordinate coord{-1, -1};
+    uint32_t distance = UNVISITED;
+};
+
+// Fixed capacity FIFO queue backed by a single allocation.
+template <typename T>
+class RingBuffer {
+  public:
+    explicit RingBuffer(size_t min_capacity) : head(0), tail(0) {
+        size_t capacity = 1;
+        while (capacity < min_capacity + 1) {
+            capacity <<= 1;
+        }
+        buffer.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    bool empty() const {
+        return head == tail;
+    }
+
+    size_t size() const {
+        return (tail - head) & mask;
+    }
+
+    void push(T value) {
+        assert(size() < mask);
+        buffer[tail] = value;
+        tail = (tail + 1) & mask;
+    }
+
+    T pop() {
+        assert(!empty());
+        T value = buffer[head];
+        head = (head + 1) & mask;
+        return value;
+    }
+
+    void clear() {
+        head = tail = 0;
+    }
+
+  private:
+    std::vector<T> buffer;
+    size_t mask;
+    size_t head;
+    size_t tail;
+};
+
+// Two bits per cell naming the neighbour offset a search reached the cell
+// through, enough to walk a route back to its source.
+class DirectionMap {
+  public:
+    void resize(size_t cells) {
+        bits.assign((cells + 3) / 4, 0);
+    }
+
+    void set(cell_t cell, uint8_t dir) {
+        assert(dir < 4);
+        uint8_t shift = static_cast<uint8_t>((cell & 3) * 2);
+        uint8_t& byte = bits[cell >> 2];
+        byte = static_cast<uint8_t>((byte & ~(3 << shift)) | (dir << shift));
+    }
+
+    uint8_t get(cell_t cell) const {
+        return (bits[cell >> 2] >> ((cell & 3) * 2)) & 3;
+    }
+
+  private:
+    std::vector<uint8_t> bits;
+};
+
+// Route found by a point-to-point search, source and target included. Empty
+// if the target cannot be reached.
+struct Route {
+    std::vector<Coordinate> cells;
+    size_t visited = 0;
+
+    size_t steps() const {
+        return cells.empty() ? 0 : cells.size() - 1;
+    }
+};
+
+// Height map stored with a one cell sentinel border on every side, so cells
+// are addressed by flat index and neighbours are always at fixed offsets.
 class Terrain {
   public:
-    explicit Terrain() : width(0), height(0), start{0, 0}, end{0, 0} {}
+    explicit Terrain() : width(0), height(0), stride(0), start{0, 0}, end{0, 0} {
+        nearest_cell.fill(0);
+        nearest_dist.fill(UNVISITED);
+        nearest_stale.fill(false);
+    }
 
     void addRow(const std::vector<uint8_t>& row) {
         if (width == 0) {
             width = row.size();
+            stride = width + 2;
+            addBorderRow();
+            addBorderRow();
         }
         assert(width == row.size());
+
+        // Drop the bottom border, then add it back below the new row.
+        height_map.resize(height_map.size() - stride);
+        dist.resize(dist.size() - stride);
         height++;
-        height_map.reserve(width * height);
-        dist.reserve(width * height);
+
+        height_map.push_back(BORDER_HEIGHT);
+        dist.push_back(BORDER_DIST);
         for (auto h : row) {
             height_map.push_back(h);
-            dist.push_back(UINT32_MAX);
+            dist.push_back(UNVISITED);
         }
+        height_map.push_back(BORDER_HEIGHT);
+        dist.push_back(BORDER_DIST);
+
+        addBorderRow();
     }
 
     void setEndpoints(const Coordinate& start, const Coordinate& end) {
@@ -53,7 +179,7 @@ class Terrain {
 
     void markVisited(const Coordinate& coord, uint32_t distance) {
         assert(isValidCoord(coord));
-        dist[coord.y * width + coord.x] = distance;
+        markVisited(cellIndex(coord), distance);
     }
 
     const Coordinate& getStart() const {
@@ -64,33 +190,769 @@ class Terrain {
         return end;
     }
 
+    size_t getColumnCount() const {
+        return width;
+    }
+
+    size_t getRowCount() const {
+        return height;
+    }
+
     bool isValidCoord(const Coordinate& coord) const {
-        return coord.x >= 0 && coord.x < width
-            && coord.y >= 0 && coord.y < height;
+        return coord.x >= 0 && static_cast<size_t>(coord.x) < width
+            && coord.y >= 0 && static_cast<size_t>(coord.y) < height;
     }
 
     bool isVisited(const Coordinate& coord) const {
         assert(isValidCoord(coord));
-        return dist[coord.y * width + coord.x] != UINT32_MAX;
+        return dist[cellIndex(coord)] != UNVISITED;
     }
 
     size_t getHeight(const Coordinate& coord) const {
         assert(isValidCoord(coord));
-        return static_cast<size_t>(height_map[coord.y * width + coord.x]);
+        return static_cast<size_t>(height_map[cellIndex(coord)]);
     }
 
     uint32_t getDistance(const Coordinate& coord) const {
         assert(isValidCoord(coord));
-        return dist[coord.y * width + coord.x];
+        return dist[cellIndex(coord)];
+    }
+
+    // Shortest distances to the end for a batch of start points, read straight
+    // from the distance field. Unreachable starts report UNVISITED.
+    std::vector<uint32_t> getDistances(const std::vector<Coordinate>& starts) const {
+        std::vector<uint32_t> distances;
+        distances.reserve(starts.size());
+        for (const auto& coord : starts) {
+            distances.push_back(isValidCoord(coord) ? getDistance(coord) : UNVISITED);
+        }
+        return distances;
+    }
+
+    // Closest start point of the given height. The distance is UNVISITED if no
+    // cell of that height can reach the end.
+    NearestCell getNearest(size_t h) const {
+        assert(h < NUM_HEIGHTS);
+        if (nearest_stale[h]) {
+            refreshNearest(h);
+        }
+        if (nearest_dist[h] == UNVISITED) {
+            return NearestCell{};
+        }
+        return NearestCell{cellCoord(nearest_cell[h]), nearest_dist[h]};
+    }
+
+    // Fills in the distance from every cell to the end with a reverse BFS, so
+    // that any start point can then be looked up without searching again. For
+    // a single start, the point-to-point searches below visit far fewer cells.
+    void computeDistances() {
+        const std::array<int64_t, 4> offsets = neighborOffsets();
+        RingBuffer<cell_t> queue(width * height);
+
+        cell_t end_cell = cellIndex(end);
+        markVisited(end_cell, 0);
+        queue.push(end_cell);
+
+        while (!queue.empty()) {
+            cell_t current = queue.pop();
+            uint32_t next_distance = dist[current] + 1;
+
+            // Cells may be stepped down to from at most one level higher. The
+            // border is never UNVISITED, so no bounds checks are needed.
+            uint32_t lowest = height_map[current];
+            for (int64_t offset : offsets) {
+                cell_t next = static_cast<cell_t>(current + offset);
+                if (dist[next] == UNVISITED && height_map[next] + 1u >= lowest) {
+                    markVisited(next, next_distance);
+                    queue.push(next);
+                }
+            }
+        }
+    }
+
+
+    // Changes the height of one cell and repairs the distance field in place.
+    // Requires computeDistances() to have run. Work is proportional to the
+    // cells whose distance changes, plus their neighbours.
+    //
+    // Edges the edit removes can only lengthen distances: every cell whose
+    // shortest routes all used them is invalidated, in increasing distance
+    // order, and given a tentative distance from its still valid neighbours.
+    // Edges the edit adds can only shorten distances. Both kinds of change are
+    // then settled by one Dijkstra-style pass that lowers distances outward
+    // from the invalidated cells and the edited cell's neighbourhood.
+    void setHeight(const Coordinate& coord, size_t h) {
+        assert(isValidCoord(coord));
+        assert(h < NUM_HEIGHTS);
+        assert(dist[cellIndex(end)] == 0);
+
+        const cell_t edited = cellIndex(coord);
+        const uint8_t old_height = height_map[edited];
+        if (old_height == h) {
+            return;
+        }
+        if (nearest_cell[old_height] == edited) {
+            nearest_stale[old_height] = true;
+        }
+        height_map[edited] = static_cast<uint8_t>(h);
+        if (dist[edited] != UNVISITED && dist[edited] < nearest_dist[h]) {
+            nearest_dist[h] = dist[edited];
+            nearest_cell[h] = edited;
+        }
+
+        if (repair_flag.size() != dist.size()) {
+            repair_flag.assign(dist.size(), 0);
+        }
+
+        const auto offsets = neighborOffsets();
+        std::array<cell_t, 5> edit_area{edited,
+            static_cast<cell_t>(edited + offsets[0]), static_cast<cell_t>(edited + offsets[1]),
+            static_cast<cell_t>(edited + offsets[2]), static_cast<cell_t>(edited + offsets[3])};
+
+        // Invalidate cells left without a neighbour one step closer to the end.
+        MinQueue queue;
+        std::vector<cell_t> invalidated;
+        for (cell_t cell : edit_area) {
+            if (isRepairable(cell)) {
+                queue.emplace(dist[cell], cell);
+            }
+        }
+        while (!queue.empty()) {
+            cell_t cell = queue.top().second;
+            queue.pop();
+            if (repair_flag[cell] || hasSupport(cell)) {
+                continue;
+            }
+
+            repair_flag[cell] = 1;
+            invalidated.push_back(cell);
+            for (int64_t offset : offsets) {
+                cell_t prev = static_cast<cell_t>(cell + offset);
+                if (isRepairable(prev) && !repair_flag[prev]
+                        && dist[prev] == dist[cell] + 1 && canStep(prev, cell)) {
+                    queue.emplace(dist[prev], prev);
+                }
+            }
+        }
+
+        for (cell_t cell : invalidated) {
+            updateDistance(cell, UNVISITED);
+        }
+        for (cell_t cell : invalidated) {
+            repair_flag[cell] = 0;
+            lowerFromNeighbors(cell, queue);
+        }
+        for (cell_t cell : edit_area) {
+            if (dist[cell] != BORDER_DIST && cell != cellIndex(end)) {
+                lowerFromNeighbors(cell, queue);
+            }
+        }
+
+        // Spread shorter distances back towards cells that can step onto them.
+        while (!queue.empty()) {
+            auto [distance, cell] = queue.top();
+            queue.pop();
+            if (distance != dist[cell]) {
+                continue;   // Stale entry.
+            }
+            for (int64_t offset : offsets) {
+                cell_t prev = static_cast<cell_t>(cell + offset);
+                if (dist[prev] != BORDER_DIST && distance + 1 < dist[prev] && canStep(prev, cell)) {
+                    updateDistance(prev, distance + 1);
+                    queue.emplace(distance + 1, prev);
+                }
+            }
+        }
+    }
+
+    // A* search from one cell to another. The heuristic is the larger of the
+    // Manhattan distance and the climb still needed, since every step moves
+    // one cell and rises at most one level; both are consistent, so every
+    // cell is expanded at most once.
+    Route findRouteAStar(const Coordinate& from, const Coordinate& to) {
+        assert(isValidCoord(from) && isValidCoord(to));
+        prepareSearch();
+
+        const auto offsets = neighborOffsets();
+        const cell_t source = cellIndex(from);
+        const cell_t target = cellIndex(to);
+        const uint32_t target_height = height_map[target];
+        auto& g = search_dist[0];
+
+        auto heuristic = [&](cell_t cell) {
+            Coordinate coord = cellCoord(cell);
+            uint32_t manhattan = static_cast<uint32_t>(abs(coord.x - to.x) + abs(coord.y - to.y));
+            uint32_t climb = target_height > height_map[cell] ? target_height - height_map[cell] : 0;
+            return std::max(manhattan, climb);
+        };
+
+        // Lowest f first; among equal f, deepest first.
+        struct Entry {
+            uint32_t f;
+            uint32_t g;
+            cell_t cell;
+
+            bool operator<(const Entry& other) const {
+                return f != other.f ? f > other.f : g < other.g;
+            }
+        };
+        std::priority_queue<Entry> open;
+
+        Route route;
+        setSearchDist(0, source, 0);
+        open.push(Entry{heuristic(source), 0, source});
+
+        while (!open.empty()) {
+            Entry current = open.top();
+            open.pop();
+            if (current.g != g[current.cell]) {
+                continue;   // Stale entry.
+            }
+            route.visited++;
+
+            if (current.cell == target) {
+                route.cells = walkBack(0, target, source);
+                std::reverse(route.cells.begin(), route.cells.end());
+                break;
+            }
+
+            // Cells may be climbed onto from at most one level below. The
+            // border is too high to climb onto, so no bounds checks are needed.
+            uint32_t highest = height_map[current.cell] + 1u;
+            for (uint8_t dir = 0; dir < offsets.size(); ++dir) {
+                cell_t next = static_cast<cell_t>(current.cell + offsets[dir]);
+                if (height_map[next] > highest || current.g + 1 >= g[next]) {
+                    continue;
+                }
+                setSearchDist(0, next, current.g + 1);
+                search_parent[0].set(next, dir);
+                open.push(Entry{current.g + 1 + heuristic(next), current.g + 1, next});
+            }
+        }
+
+        finishSearch();
+        return route;
+    }
+
+    // Bidirectional BFS from one cell to another: a forward search from the
+    // source and a reverse search from the target, expanding whichever
+    // frontier is smaller one whole level at a time until they meet.
+    Route findRouteBidirectional(const Coordinate& from, const Coordinate& to) {
+        assert(isValidCoord(from) && isValidCoord(to));
+        prepareSearch();
+
+        const auto offsets = neighborOffsets();
+        const cell_t source = cellIndex(from);
+        const cell_t target = cellIndex(to);
+
+        std::array<std::vector<cell_t>, 2> frontier{std::vector<cell_t>{source}, std::vector<cell_t>{target}};
+        std::vector<cell_t> next;
+        setSearchDist(0, source, 0);
+        setSearchDist(1, target, 0);
+
+        // Best meeting edge found so far, as a forward step meet_from -> meet_to.
+        Route route;
+        uint32_t best = (source == target) ? 0 : UNVISITED;
+        cell_t meet_from = source;
+        cell_t meet_to = target;
+
+        while (best == UNVISITED && !frontier[0].empty() && !frontier[1].empty()) {
+            const size_t side = frontier[0].size() <= frontier[1].size() ? 0 : 1;
+            auto& own = search_dist[side];
+            auto& other = search_dist[1 - side];
+
+            next.clear();
+            for (cell_t current : frontier[side]) {
+                route.visited++;
+                for (uint8_t dir = 0; dir < offsets.size(); ++dir) {
+                    cell_t cell = static_cast<cell_t>(current + offsets[dir]);
+
+                    // Forward steps climb at most one level, reverse steps
+                    // descend at most one. The border is never UNVISITED.
+                    bool passable = (side == 0)
+                        ? height_map[cell] <= height_map[current] + 1u
+                        : height_map[current] <= height_map[cell] + 1u;
+                    if (!passable || own[cell] == BORDER_DIST) {
+                        continue;
+                    }
+
+                    if (other[cell] != UNVISITED && own[current] + 1 + other[cell] < best) {
+                        best = own[current] + 1 + other[cell];
+                        meet_from = (side == 0) ? current : cell;
+                        meet_to = (side == 0) ? cell : current;
+                    }
+                    if (own[cell] == UNVISITED) {
+                        setSearchDist(side, cell, own[current] + 1);
+                        search_parent[side].set(cell, dir);
+                        next.push_back(cell);
+                    }
+                }
+            }
+            frontier[side].swap(next);
+        }
+
+        if (best != UNVISITED) {
+            route.cells = walkBack(0, meet_from, source);
+            std::reverse(route.cells.begin(), route.cells.end());
+            if (meet_to != meet_from) {
+                auto tail = walkBack(1, meet_to, target);
+                route.cells.insert(route.cells.end(), tail.begin(), tail.end());
+            }
+        }
+
+        finishSearch();
+        return route;
     }
 
   private:
+    void addBorderRow() {
+        height_map.insert(height_map.end(), stride, BORDER_HEIGHT);
+        dist.insert(dist.end(), stride, BORDER_DIST);
+    }
+
+    cell_t cellIndex(const Coordinate& coord) const {
+        return static_cast<cell_t>((coord.y + 1) * stride + (coord.x + 1));
+    }
+
+    Coordinate cellCoord(cell_t cell) const {
+        return Coordinate{
+            static_cast<int32_t>(cell % stride) - 1,
+            static_cast<int32_t>(cell / stride) - 1};
+    }
+
+    std::array<int64_t, 4> neighborOffsets() const {
+        int64_t row = static_cast<int64_t>(stride);
+        return {row, -row, 1, -1};
+    }
+
+    void markVisited(cell_t cell, uint32_t distance) {
+        dist[cell] = distance;
+
+        // Cells are visited in BFS order, so the first of each height is the nearest.
+        uint8_t h = height_map[cell];
+        if (distance < nearest_dist[h]) {
+            nearest_dist[h] = distance;
+            nearest_cell[h] = cell;
+        }
+    }
+
+    using MinQueue = std::priority_queue<
+        std::pair<uint32_t, cell_t>,
+        std::vector<std::pair<uint32_t, cell_t>>,
+        std::greater<std::pair<uint32_t, cell_t>>>;
+
+    // Whether a route may step from one cell onto a neighbour.
+    bool canStep(cell_t from, cell_t to) const {
+        return height_map[to] <= height_map[from] + 1u;
+    }
+
+    // Cells whose distance a repair may have to invalidate.
+    bool isRepairable(cell_t cell) const {
+        return dist[cell] != BORDER_DIST && dist[cell] != UNVISITED && cell != cellIndex(end);
+    }
+
+    // Whether a cell still has a valid neighbour exactly one step closer to
+    // the end that it can step onto.
+    bool hasSupport(cell_t cell) const {
+        for (int64_t offset : neighborOffsets()) {
+            cell_t next = static_cast<cell_t>(cell + offset);
+            if (!repair_flag[next] && dist[next] < BORDER_DIST && dist[next] + 1 == dist[cell]
+                    && canStep(cell, next)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Lowers a cell's distance to one past its best neighbour, queueing it if
+    // that improved it.
+    void lowerFromNeighbors(cell_t cell, MinQueue& queue) {
+        uint32_t best = dist[cell];
+        for (int64_t offset : neighborOffsets()) {
+            cell_t next = static_cast<cell_t>(cell + offset);
+            if (dist[next] < BORDER_DIST && dist[next] + 1 < best && canStep(cell, next)) {
+                best = dist[next] + 1;
+            }
+        }
+        if (best < dist[cell]) {
+            updateDistance(cell, best);
+            queue.emplace(best, cell);
+        }
+    }
+
+    // Sets a distance outside of BFS order, keeping the nearest cell of its
+    // height up to date or marking it for a rescan.
+    void updateDistance(cell_t cell, uint32_t distance) {
+        uint8_t h = height_map[cell];
+        if (distance < nearest_dist[h]) {
+            nearest_dist[h] = distance;
+            nearest_cell[h] = cell;
+        } else if (nearest_cell[h] == cell && distance != nearest_dist[h]) {
+            nearest_stale[h] = true;
+        }
+        dist[cell] = distance;
+    }
+
+    void refreshNearest(size_t h) const {
+        nearest_dist[h] = UNVISITED;
+        for (cell_t cell = 0; cell < dist.size(); ++cell) {
+            if (height_map[cell] == h && dist[cell] < nearest_dist[h]) {
+                nearest_dist[h] = dist[cell];
+                nearest_cell[h] = cell;
+            }
+        }
+        nearest_stale[h] = false;
+    }
+
+    // Point-to-point searches keep their state in arrays allocated once and
+    // reset through the touched list, so a query costs only what it visits.
+    void prepareSearch() {
+        if (search_dist[0].size() != dist.size()) {
+            for (size_t side = 0; side < 2; ++side) {
+                search_dist[side].resize(dist.size());
+                for (size_t cell = 0; cell < dist.size(); ++cell) {
+                    search_dist[side][cell] = (dist[cell] == BORDER_DIST) ? BORDER_DIST : UNVISITED;
+                }
+                search_parent[side].resize(dist.size());
+            }
+        }
+        assert(touched.empty());
+    }
+
+    void setSearchDist(size_t side, cell_t cell, uint32_t distance) {
+        if (search_dist[0][cell] == UNVISITED && search_dist[1][cell] == UNVISITED) {
+            touched.push_back(cell);
+        }
+        search_dist[side][cell] = distance;
+    }
+
+    void finishSearch() {
+        for (cell_t cell : touched) {
+            search_dist[0][cell] = UNVISITED;
+            search_dist[1][cell] = UNVISITED;
+        }
+        touched.clear();
+    }
+
+    // Follows one side's parent directions from cell back to its root.
+    std::vector<Coordinate> walkBack(size_t side, cell_t cell, cell_t root) const {
+        const auto offsets = neighborOffsets();
+        std::vector<Coordinate> cells;
+        cells.reserve(search_dist[side][cell] + 1);
+        while (cell != root) {
+            cells.push_back(cellCoord(cell));
+            cell = static_cast<cell_t>(cell - offsets[search_parent[side].get(cell)]);
+        }
+        cells.push_back(cellCoord(root));
+        return cells;
+    }
+
     size_t width;
     size_t height;
+    size_t stride;
     std::vector<uint8_t> height_map;
     std::vector<uint32_t> dist;
     Coordinate start;
     Coordinate end;
+
+    // Nearest cell of each height. After edits a height may need a rescan.
+    mutable std::array<cell_t, NUM_HEIGHTS> nearest_cell;
+    mutable std::array<uint32_t, NUM_HEIGHTS> nearest_dist;
+    mutable std::array<bool, NUM_HEIGHTS> nearest_stale;
+
+    // Cells invalidated by the setHeight() repair in progress.
+    std::vector<uint8_t> repair_flag;
+
+    // Point-to-point search state: forward side 0 and reverse side 1.
+    std::array<std::vector<uint32_t>, 2> search_dist;
+    std::array<DirectionMap, 2> search_parent;
+    std::vector<cell_t> touched;
+};
+
+// Number of bits in one bitboard word.
+constexpr size_t WORD_BITS = 64;
+
+// Threshold mask slots stored per bitboard word. Slot h + 1 holds cells of
+// height h or more, for h from -1 to NUM_HEIGHTS; the rest pad to a power of two.
+constexpr size_t MASK_SLOTS = 32;
+
+// Heights handled per AVX2 vector.
+constexpr size_t HEIGHT_LANES = 4;
+
+// Reverse BFS that advances the whole frontier one level at a time using row
+// bitboards, for maps too large for the scalar BFS to stay in cache.
+//
+// Only words with frontier bits in or next to them are expanded. Like Terrain,
+// every board has a border: one zero word on each side of a row and one zero
+// row above and below the map, so shifts and row offsets need no bounds checks.
+class BitBoardSearch {
+  public:
+    explicit BitBoardSearch(const Terrain& terrain) :
+        width(terrain.getColumnCount()),
+        rows(terrain.getRowCount()),
+        words((width + WORD_BITS - 1) / WORD_BITS),
+        stride(words + 2),
+        end(terrain.getEnd())
+    {
+        size_t size = (rows + 2) * stride;
+        masks.assign(size * MASK_SLOTS, 0);
+
+        // Border words get an empty height range.
+        word_lo.assign(size, UINT8_MAX);
+        word_hi.assign(size, 0);
+
+        // Threshold masks for a word sit side by side, so expanding every
+        // height band of a word touches a few cache lines rather than one per
+        // height. The mask for height h - 1 is exactly the set of cells a cell
+        // of height h may step down to.
+        for (size_t y = 0; y < rows; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                auto h = static_cast<uint8_t>(terrain.getHeight(Coordinate{
+                    static_cast<int32_t>(x), static_cast<int32_t>(y)}));
+                size_t w = wordIndex(x, y);
+                for (size_t slot = 0; slot <= h + 1u; ++slot) {
+                    masks[w * MASK_SLOTS + slot] |= bitMask(x);
+                }
+                word_lo[w] = std::min(word_lo[w], h);
+                word_hi[w] = std::max(word_hi[w], h);
+            }
+        }
+
+        frontier.resize(size);
+        next.resize(size);
+        visited.resize(size);
+        seen_level.resize(size);
+
+#if defined(HAVE_AVX2_KERNEL)
+        use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    // Levels from the end to the nearest cell of height h, or UNVISITED.
+    uint32_t levelsToHeight(size_t h) {
+        assert(h < NUM_HEIGHTS);
+        std::vector<uint64_t> board(frontier.size());
+        for (size_t w = 0; w < board.size(); ++w) {
+            board[w] = band(w, h);
+        }
+        return search(&board, nullptr);
+    }
+
+    // Levels from the end to the given cell, or UNVISITED.
+    uint32_t levelsTo(const Coordinate& target) {
+        std::vector<uint64_t> board(frontier.size(), 0);
+        board[wordIndex(target.x, target.y)] |= bitMask(target.x);
+        return search(&board, nullptr);
+    }
+
+    // Runs the search to exhaustion, recovering the distance of every cell from
+    // the level at which it joined the frontier. Cells are indexed y * width + x.
+    std::vector<uint32_t> distances() {
+        std::vector<uint32_t> dist(width * rows, UNVISITED);
+        search(nullptr, &dist);
+        return dist;
+    }
+
+  private:
+    size_t wordIndex(size_t x, size_t y) const {
+        return (y + 1) * stride + 1 + x / WORD_BITS;
+    }
+
+    static uint64_t bitMask(size_t x) {
+        return uint64_t{1} << (x % WORD_BITS);
+    }
+
+    // Cells of exactly height h within word w.
+    uint64_t band(size_t w, size_t h) const {
+        return masks[w * MASK_SLOTS + h + 1] & ~masks[w * MASK_SLOTS + h + 2];
+    }
+
+    bool isBorderWord(size_t w) const {
+        size_t r = w / stride;
+        size_t i = w % stride;
+        return r == 0 || r > rows || i == 0 || i > words;
+    }
+
+    // Expands level by level until the frontier meets target, returning that
+    // level. Without a target, runs until the frontier empties and returns the
+    // deepest level reached.
+    uint32_t search(const std::vector<uint64_t>* target, std::vector<uint32_t>* dist) {
+        std::fill(frontier.begin(), frontier.end(), 0);
+        std::fill(next.begin(), next.end(), 0);
+        std::fill(visited.begin(), visited.end(), 0);
+        std::fill(seen_level.begin(), seen_level.end(), UNVISITED);
+        active.clear();
+        next_active.clear();
+
+        size_t start = wordIndex(end.x, end.y);
+        frontier[start] |= bitMask(end.x);
+        visited[start] |= bitMask(end.x);
+        active.push_back(static_cast<uint32_t>(start));
+
+        uint32_t level = 0;
+        while (true) {
+            if (dist != nullptr) {
+                recordLevel(*dist, level);
+            }
+            if (target != nullptr && intersects(*target)) {
+                return level;
+            }
+            if (!expand(level)) {
+                return target != nullptr ? UNVISITED : level;
+            }
+
+            frontier.swap(next);
+            active.swap(next_active);
+            level++;
+        }
+    }
+
+    // Builds the next frontier from every word in or next to the active list.
+    bool expand(uint32_t level) {
+        // The buffer still holds the frontier from two levels ago.
+        for (uint32_t w : next_active) {
+            next[w] = 0;
+        }
+        next_active.clear();
+
+        for (size_t w : active) {
+            for (size_t candidate : {w - stride, w - 1, w, w + 1, w + stride}) {
+                if (seen_level[candidate] == level || isBorderWord(candidate)) {
+                    continue;
+                }
+                seen_level[candidate] = level;
+
+                next[candidate] = expandWord(candidate) & ~visited[candidate];
+                if (next[candidate] != 0) {
+                    visited[candidate] |= next[candidate];
+                    next_active.push_back(static_cast<uint32_t>(candidate));
+                }
+            }
+        }
+        return !next_active.empty();
+    }
+
+    // Dilates every height band present around word w and masks it with the
+    // cells that band may step down to.
+    uint64_t expandWord(size_t w) const {
+        const size_t h_lo = std::min({word_lo[w - 1], word_lo[w], word_lo[w + 1],
+            word_lo[w - stride], word_lo[w + stride]});
+        const size_t h_hi = std::max({word_hi[w - 1], word_hi[w], word_hi[w + 1],
+            word_hi[w - stride], word_hi[w + stride]});
+
+#if defined(HAVE_AVX2_KERNEL)
+        if (use_avx2) {
+            return expandWordAvx2(w, h_lo, h_hi);
+        }
+#endif
+        const uint64_t fm = frontier[w];
+        const uint64_t fl = frontier[w - 1];
+        const uint64_t fr = frontier[w + 1];
+        const uint64_t fu = frontier[w - stride];
+        const uint64_t fd = frontier[w + stride];
+
+        uint64_t acc = 0;
+        for (size_t h = h_lo; h <= h_hi; ++h) {
+            uint64_t m = fm & band(w, h);
+            uint64_t d = m | (m << 1) | ((fl & band(w - 1, h)) >> (WORD_BITS - 1))
+                | (m >> 1) | ((fr & band(w + 1, h)) << (WORD_BITS - 1))
+                | (fu & band(w - stride, h)) | (fd & band(w + stride, h));
+            acc |= d & masks[w * MASK_SLOTS + h];
+        }
+        return acc;
+    }
+
+#if defined(HAVE_AVX2_KERNEL)
+    // Threshold masks for heights h - 1 to h + 2 of a word.
+    __attribute__((target("avx2")))
+    __m256i loadMasks(size_t word, size_t slot) const {
+        return _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(masks.data() + word * MASK_SLOTS + slot));
+    }
+
+    // Frontier bits of a word in bands h to h + 3.
+    __attribute__((target("avx2")))
+    __m256i frontierBands(uint64_t bits, size_t word, size_t h) const {
+        __m256i f = _mm256_set1_epi64x(static_cast<int64_t>(bits));
+        return _mm256_andnot_si256(loadMasks(word, h + 2), _mm256_and_si256(f, loadMasks(word, h + 1)));
+    }
+
+    // expandWord with four heights per vector. Lanes past h_hi see only empty
+    // bands. Compiled for AVX2 on its own, and only called when the CPU has it.
+    __attribute__((target("avx2")))
+    uint64_t expandWordAvx2(size_t w, size_t h_lo, size_t h_hi) const {
+        const uint64_t fm = frontier[w];
+        const uint64_t fl = frontier[w - 1];
+        const uint64_t fr = frontier[w + 1];
+        const uint64_t fu = frontier[w - stride];
+        const uint64_t fd = frontier[w + stride];
+
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t h = h_lo; h <= h_hi; h += HEIGHT_LANES) {
+            __m256i m = frontierBands(fm, w, h);
+            __m256i d = _mm256_or_si256(
+                _mm256_or_si256(_mm256_slli_epi64(m, 1),
+                    _mm256_srli_epi64(frontierBands(fl, w - 1, h), WORD_BITS - 1)),
+                _mm256_or_si256(_mm256_srli_epi64(m, 1),
+                    _mm256_slli_epi64(frontierBands(fr, w + 1, h), WORD_BITS - 1)));
+            d = _mm256_or_si256(d, _mm256_or_si256(m,
+                _mm256_or_si256(frontierBands(fu, w - stride, h), frontierBands(fd, w + stride, h))));
+            acc = _mm256_or_si256(acc, _mm256_and_si256(d, loadMasks(w, h)));
+        }
+
+        __m128i half = _mm_or_si128(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        return static_cast<uint64_t>(_mm_cvtsi128_si64(half))
+            | static_cast<uint64_t>(_mm_extract_epi64(half, 1));
+    }
+#endif
+
+    bool intersects(const std::vector<uint64_t>& board) const {
+        for (uint32_t w : active) {
+            if (frontier[w] & board[w]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void recordLevel(std::vector<uint32_t>& dist, uint32_t level) const {
+        for (uint32_t w : active) {
+            size_t y = w / stride - 1;
+            size_t x0 = (w % stride - 1) * WORD_BITS;
+            uint64_t bits = frontier[w];
+            while (bits != 0) {
+                size_t x = x0 + static_cast<size_t>(__builtin_ctzll(bits));
+                dist[y * width + x] = level;
+                bits &= bits - 1;
+            }
+        }
+    }
+
+    size_t width;
+    size_t rows;
+    size_t words;
+    size_t stride;
+    Coordinate end;
+
+    // Height threshold masks, MASK_SLOTS per word.
+    std::vector<uint64_t> masks;
+
+    // Lowest and highest height within each word, so expansion only tries the
+    // bands that actually occur around a word.
+    std::vector<uint8_t> word_lo;
+    std::vector<uint8_t> word_hi;
+
+    std::vector<uint64_t> frontier;
+    std::vector<uint64_t> next;
+    std::vector<uint64_t> visited;
+
+    // Words holding frontier bits, and the level each word was last expanded.
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> next_active;
+    std::vector<uint32_t> seen_level;
+
+    // Whether the CPU can run expandWordAvx2.
+    bool use_avx2 = false;
 };
 
 Terrain parseTerrain(std::istream& input) {
@@ -127,56 +989,68 @@ Terrain parseTerrain(std::istream& input) {
     return terrain;
 }
 
-void addNeighbor(
-    Terrain& terrain,
-    std::queue<Coordinate>& queue,
-    const Coordinate& coord,
-    size_t height,
-    uint32_t distance
-) {
-    if (!terrain.isValidCoord(coord)
-        || terrain.isVisited(coord)
-        || !(terrain.getHeight(coord) >= height || terrain.getHeight(coord) + 1 == height)) {
-        return;
-    }
-
-    terrain.markVisited(coord, distance + 1);
-    queue.push(coord);
+size_t shortestPath(const Terrain& terrain) {
+    auto distance = terrain.getNearest(0).distance;
+    if (distance == UNVISITED) {
+        throw std::runtime_error("Could not find path");
+    }
+    return static_cast<size_t>(distance);
 }
 
-// A* path search would be faster, but BFS is simpler to implement.
-size_t shortestPath(Terrain& terrain) {
-    terrain.markVisited(terrain.getEnd(), 0);
-
-    std::queue<Coordinate> queue;
-    queue.push(terrain.getEnd());
+void printFromStart(uint32_t distance) {
+    if (distance != UNVISITED) {
+        std::cout << "Shortest path from start is " << distance << " steps" << std::endl;
+    }
+}
 
-    while (!queue.empty()) {
-        Coordinate current = queue.front();
-        queue.pop();
+int main(int argc, char** argv) {
+    Terrain terrain = parseTerrain(std::cin);
 
-        auto height = terrain.getHeight(current);
-        auto distance = terrain.getDistance(current);
+    // With --from-start the full searches also report the distance from S.
+    const char* mode = "";
+    bool from_start = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--from-start") == 0) {
+            from_start = true;
+        } else {
+            mode = argv[i];
+        }
+    }
 
-        // Reached starting point.
-        if (height == 0) {
-            return static_cast<size_t>(distance);
+    // Point-to-point searches from the start only.
+    if (strcmp(mode, "--astar") == 0 || strcmp(mode, "--bidirectional") == 0) {
+        Route route = (strcmp(mode, "--astar") == 0)
+            ? terrain.findRouteAStar(terrain.getStart(), terrain.getEnd())
+            : terrain.findRouteBidirectional(terrain.getStart(), terrain.getEnd());
+        if (route.cells.empty()) {
+            throw std::runtime_error("Could not find path");
         }
+        std::cout << "Shortest path from start is " << route.steps() << " steps"
+            << " (" << route.visited << " cells visited)" << std::endl;
+        return 0;
+    }
 
-        // Add neighbors.
-        addNeighbor(terrain, queue, Coordinate{current.x, current.y + 1}, height, distance);
-        addNeighbor(terrain, queue, Coordinate{current.x, current.y - 1}, height, distance);
-        addNeighbor(terrain, queue, Coordinate{current.x + 1, current.y}, height, distance);
-        addNeighbor(terrain, queue, Coordinate{current.x - 1, current.y}, height, distance);
+    // Bit-parallel engine for very large maps.
+    if (strcmp(mode, "--bitboard") == 0) {
+        BitBoardSearch search(terrain);
+        if (from_start) {
+            printFromStart(search.levelsTo(terrain.getStart()));
+        }
+        auto steps = search.levelsToHeight(0);
+        if (steps == UNVISITED) {
+            throw std::runtime_error("Could not find path");
+        }
+        std::cout << "Shortest path is " << steps << " steps" << std::endl;
+        return 0;
     }
 
-    throw std::runtime_error("Could not find path");
-}
+    terrain.computeDistances();
 
-int main() {
-    Terrain terrain = parseTerrain(std::cin);
-    auto steps = shortestPath(terrain);
+    if (from_start) {
+        printFromStart(terrain.getDistances({terrain.getStart()})[0]);
+    }
 
+    auto steps = shortestPath(terrain);
     std::cout << "Shortest path is " << steps << " steps" << std::endl;
     return 0;
 }
@@ -0,0 +1,820 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Hierarchical path search for hill maps too large to hold in memory.
+//
+//   tiled_hill build <file> [tile_size] < map.txt
+//     Streams a map into a tiled height file plus <file>.graph, an abstract
+//     graph of tile border crossings with exact in-tile distances between them.
+//
+//   tiled_hill query <file> [x1 y1 x2 y2]
+//     Finds a route on the abstract graph (start to end by default), then
+//     refines it with an exact search confined to the tiles it passes through.
+//
+// Both files are memory mapped, so a query only pages in the graph nodes and
+// tiles it touches. As with HPA*, the refined route is the shortest one inside
+// the corridor of tiles the abstract route picked, which can be longer than
+// the shortest path on the whole map: the puzzle with 5 cell tiles gives 522
+// steps where the shortest path is 520.
+
+// Number of distinct terrain heights, 'a' through 'z'.
+constexpr uint8_t NUM_HEIGHTS = 26;
+
+// Height of cells past the edge of the map. Nothing can climb onto it.
+constexpr uint8_t BORDER_HEIGHT = UINT8_MAX;
+
+constexpr uint32_t UNVISITED = UINT32_MAX;
+
+constexpr size_t DEFAULT_TILE_SIZE = 256;
+
+// Crossing runs at least this long get a transition at each end, shorter
+// ones a single transition in the middle.
+constexpr size_t LONG_RUN = 8;
+
+constexpr char TILE_MAGIC[8] = {'H', 'I', 'L', 'L', 'T', 'I', 'L', 'E'};
+constexpr char GRAPH_MAGIC[8] = {'H', 'I', 'L', 'L', 'G', 'R', 'P', 'H'};
+
+struct Coordinate {
+    Coordinate(int32_t x, int32_t y) : x(x), y(y) {}
+
+    int32_t x;
+    int32_t y;
+
+    bool operator==(const Coordinate& other) const {
+        return x == other.x && y == other.y;
+    }
+};
+
+bool canStep(uint8_t from, uint8_t to) {
+    return to <= from + 1u;
+}
+
+uint32_t heuristic(const Coordinate& from, uint8_t from_height, const Coordinate& to, uint8_t to_height) {
+    uint32_t manhattan = static_cast<uint32_t>(abs(from.x - to.x) + abs(from.y - to.y));
+    uint32_t climb = to_height > from_height ? to_height - from_height : 0;
+    return std::max(manhattan, climb);
+}
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string& path) : data(nullptr), size(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat info;
+        fstat(fd, &info);
+        size = static_cast<size_t>(info.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error("Cannot map " + path);
+        }
+        data = static_cast<const uint8_t*>(addr);
+    }
+
+    ~MappedFile() {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* bytes() const {
+        return data;
+    }
+
+    size_t getSize() const {
+        return size;
+    }
+
+  private:
+    const uint8_t* data;
+    size_t size;
+};
+
+struct TileHeader {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_size;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    int32_t start_x;
+    int32_t start_y;
+    int32_t end_x;
+    int32_t end_y;
+    uint32_t reserved;
+};
+
+// Height map split into square tiles, each stored row-major and contiguous.
+// Tiles on the right and bottom edges are padded with BORDER_HEIGHT.
+class TiledTerrain {
+  public:
+    explicit TiledTerrain(const std::string& path) : file(path) {
+        if (file.getSize() < sizeof(TileHeader)) {
+            throw std::runtime_error("Truncated tile file");
+        }
+        std::memcpy(&header, file.bytes(), sizeof(TileHeader));
+        if (std::memcmp(header.magic, TILE_MAGIC, sizeof(TILE_MAGIC)) != 0) {
+            throw std::runtime_error("Not a tile file");
+        }
+        tile_cells = static_cast<size_t>(header.tile_size) * header.tile_size;
+        if (file.getSize() < sizeof(TileHeader) + getTileCount() * tile_cells) {
+            throw std::runtime_error("Truncated tile file");
+        }
+    }
+
+    uint32_t getWidth() const {
+        return header.width;
+    }
+
+    uint32_t getHeight() const {
+        return header.height;
+    }
+
+    uint32_t getTileSize() const {
+        return header.tile_size;
+    }
+
+    uint32_t getTilesX() const {
+        return header.tiles_x;
+    }
+
+    size_t getTileCount() const {
+        return static_cast<size_t>(header.tiles_x) * header.tiles_y;
+    }
+
+    Coordinate getStart() const {
+        return Coordinate{header.start_x, header.start_y};
+    }
+
+    Coordinate getEnd() const {
+        return Coordinate{header.end_x, header.end_y};
+    }
+
+    bool isValidCoord(const Coordinate& coord) const {
+        return coord.x >= 0 && static_cast<uint32_t>(coord.x) < header.width
+            && coord.y >= 0 && static_cast<uint32_t>(coord.y) < header.height;
+    }
+
+    uint32_t tileOf(const Coordinate& coord) const {
+        return (coord.y / header.tile_size) * header.tiles_x + coord.x / header.tile_size;
+    }
+
+    Coordinate tileOrigin(uint32_t tile) const {
+        return Coordinate{
+            static_cast<int32_t>((tile % header.tiles_x) * header.tile_size),
+            static_cast<int32_t>((tile / header.tiles_x) * header.tile_size)};
+    }
+
+    const uint8_t* tileData(uint32_t tile) const {
+        return file.bytes() + sizeof(TileHeader) + tile * tile_cells;
+    }
+
+    uint8_t heightAt(const Coordinate& coord) const {
+        if (!isValidCoord(coord)) {
+            return BORDER_HEIGHT;
+        }
+        uint32_t local_x = coord.x % header.tile_size;
+        uint32_t local_y = coord.y % header.tile_size;
+        return tileData(tileOf(coord))[local_y * header.tile_size + local_x];
+    }
+
+  private:
+    MappedFile file;
+    TileHeader header;
+    size_t tile_cells;
+};
+
+// Streams a text map into a tile file, holding only one row of tiles in memory.
+void buildTiles(std::istream& input, const std::string& path, uint32_t tile_size) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot create " + path);
+    }
+
+    TileHeader header{};
+    std::memcpy(header.magic, TILE_MAGIC, sizeof(TILE_MAGIC));
+    header.tile_size = tile_size;
+    header.start_x = header.start_y = header.end_x = header.end_y = -1;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<uint8_t> band;
+    auto flushBand = [&]() {
+        for (uint32_t tx = 0; tx < header.tiles_x; ++tx) {
+            for (uint32_t row = 0; row < tile_size; ++row) {
+                out.write(reinterpret_cast<const char*>(
+                    band.data() + row * header.tiles_x * tile_size + tx * tile_size), tile_size);
+            }
+        }
+        std::fill(band.begin(), band.end(), BORDER_HEIGHT);
+        header.tiles_y++;
+    };
+
+    std::string line;
+    while (std::getline(input, line)) {
+        if (header.width == 0) {
+            header.width = static_cast<uint32_t>(line.size());
+            header.tiles_x = (header.width + tile_size - 1) / tile_size;
+            band.assign(static_cast<size_t>(header.tiles_x) * tile_size * tile_size, BORDER_HEIGHT);
+        }
+        if (line.size() != header.width) {
+            throw std::runtime_error("Ragged map row");
+        }
+
+        uint8_t* row = band.data() + (header.height % tile_size) * header.tiles_x * tile_size;
+        for (uint32_t x = 0; x < header.width; ++x) {
+            if (line[x] == 'S') {
+                header.start_x = static_cast<int32_t>(x);
+                header.start_y = static_cast<int32_t>(header.height);
+                row[x] = 0;
+            } else if (line[x] == 'E') {
+                header.end_x = static_cast<int32_t>(x);
+                header.end_y = static_cast<int32_t>(header.height);
+                row[x] = NUM_HEIGHTS - 1;
+            } else {
+                assert(line[x] >= 'a' && line[x] <= 'z');
+                row[x] = static_cast<uint8_t>(line[x] - 'a');
+            }
+        }
+
+        header.height++;
+        if (header.height % tile_size == 0) {
+            flushBand();
+        }
+    }
+    if (header.height % tile_size != 0) {
+        flushBand();
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+// BFS confined to one tile. Forward searches follow climbable steps out of
+// the source, reverse searches follow them into it. Distances are indexed by
+// local cell, UNVISITED where unreachable.
+void tileDistances(
+    const TiledTerrain& terrain,
+    uint32_t tile,
+    uint32_t source,
+    bool forward,
+    std::vector<uint32_t>& dist,
+    std::vector<uint32_t>& queue
+) {
+    const uint32_t size = terrain.getTileSize();
+    const uint8_t* heights = terrain.tileData(tile);
+    dist.assign(static_cast<size_t>(size) * size, UNVISITED);
+    queue.clear();
+
+    dist[source] = 0;
+    queue.push_back(source);
+    for (size_t head = 0; head < queue.size(); ++head) {
+        uint32_t cell = queue[head];
+        uint32_t x = cell % size;
+        uint32_t y = cell / size;
+
+        auto visit = [&](uint32_t next) {
+            bool passable = forward ? canStep(heights[cell], heights[next]) : canStep(heights[next], heights[cell]);
+            if (passable && heights[next] != BORDER_HEIGHT && dist[next] == UNVISITED) {
+                dist[next] = dist[cell] + 1;
+                queue.push_back(next);
+            }
+        };
+        if (x > 0) visit(cell - 1);
+        if (x + 1 < size) visit(cell + 1);
+        if (y > 0) visit(cell - size);
+        if (y + 1 < size) visit(cell + size);
+    }
+}
+
+struct GraphHeader {
+    char magic[8];
+    uint64_t node_count;
+    uint64_t edge_count;
+    uint64_t tile_count;
+};
+
+// Abstract graph node: a cell on a tile border where a route may cross.
+struct GraphNode {
+    int32_t x;
+    int32_t y;
+    uint32_t height;
+};
+
+struct GraphEdge {
+    uint32_t target;
+    uint32_t weight;
+};
+
+// Builds the abstract graph. Nodes are numbered tile by tile, so the nodes of a
+// tile form one contiguous range.
+void buildGraph(const TiledTerrain& terrain, const std::string& path) {
+    const uint32_t size = terrain.getTileSize();
+    const uint32_t tiles_x = terrain.getTilesX();
+    const uint32_t tiles_y = static_cast<uint32_t>(terrain.getTileCount() / tiles_x);
+
+    // Transitions as pairs of cells either side of a tile border.
+    struct Crossing {
+        Coordinate from;
+        Coordinate to;
+    };
+    std::vector<Crossing> crossings;
+
+    // Picks transitions along one border. A run is a stretch of positions
+    // where the step across is possible and neighbouring cells on both sides
+    // can step to each other both ways, so a route crossing anywhere in a run
+    // can walk along the border to its transition. A run gets one transition
+    // in the middle, or one at each end if it is long.
+    auto scanBorder = [&](Coordinate a, Coordinate b, int32_t dx, int32_t dy) {
+        auto at = [&](Coordinate base, uint32_t i) {
+            return Coordinate{base.x + dx * static_cast<int32_t>(i), base.y + dy * static_cast<int32_t>(i)};
+        };
+        auto twoWay = [&](const Coordinate& p, const Coordinate& q) {
+            uint8_t hp = terrain.heightAt(p);
+            uint8_t hq = terrain.heightAt(q);
+            return canStep(hp, hq) && canStep(hq, hp);
+        };
+
+        for (int dir = 0; dir < 2; ++dir) {
+            const Coordinate from_base = (dir == 0) ? a : b;
+            const Coordinate to_base = (dir == 0) ? b : a;
+
+            uint32_t run = 0;
+            auto closeRun = [&](uint32_t end) {
+                if (run == 0) {
+                    return;
+                }
+                std::vector<uint32_t> picks;
+                if (run >= LONG_RUN) {
+                    picks = {end - run, end - 1};
+                } else {
+                    picks = {end - run + (run - 1) / 2};
+                }
+                for (uint32_t pick : picks) {
+                    crossings.push_back(Crossing{at(from_base, pick), at(to_base, pick)});
+                }
+                run = 0;
+            };
+
+            for (uint32_t i = 0; i < size; ++i) {
+                Coordinate from = at(from_base, i);
+                Coordinate to = at(to_base, i);
+                uint8_t from_height = terrain.heightAt(from);
+                uint8_t to_height = terrain.heightAt(to);
+                bool crossable = from_height != BORDER_HEIGHT && to_height != BORDER_HEIGHT
+                    && canStep(from_height, to_height);
+
+                if (run > 0 && !(crossable && twoWay(at(from_base, i - 1), from)
+                        && twoWay(at(to_base, i - 1), to))) {
+                    closeRun(i);
+                }
+                if (crossable) {
+                    run++;
+                }
+            }
+            closeRun(size);
+        }
+    };
+
+    for (uint32_t ty = 0; ty < tiles_y; ++ty) {
+        for (uint32_t tx = 0; tx < tiles_x; ++tx) {
+            int32_t x0 = static_cast<int32_t>(tx * size);
+            int32_t y0 = static_cast<int32_t>(ty * size);
+            int32_t edge = static_cast<int32_t>(size);
+            if (tx + 1 < tiles_x) {
+                scanBorder(Coordinate{x0 + edge - 1, y0}, Coordinate{x0 + edge, y0}, 0, 1);
+            }
+            if (ty + 1 < tiles_y) {
+                scanBorder(Coordinate{x0, y0 + edge - 1}, Coordinate{x0, y0 + edge}, 1, 0);
+            }
+        }
+    }
+
+    // Number the distinct crossing cells tile by tile.
+    auto key = [&](const Coordinate& c) {
+        return (static_cast<uint64_t>(terrain.tileOf(c)) << 32)
+            | (static_cast<uint64_t>(c.y % size) * size + c.x % size);
+    };
+    std::vector<uint64_t> keys;
+    keys.reserve(crossings.size() * 2);
+    for (const auto& crossing : crossings) {
+        keys.push_back(key(crossing.from));
+        keys.push_back(key(crossing.to));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<GraphNode> nodes;
+    std::vector<uint64_t> tile_offsets(terrain.getTileCount() + 1, 0);
+    nodes.reserve(keys.size());
+    for (uint64_t k : keys) {
+        uint32_t tile = static_cast<uint32_t>(k >> 32);
+        uint32_t local = static_cast<uint32_t>(k);
+        Coordinate origin = terrain.tileOrigin(tile);
+        Coordinate coord{origin.x + static_cast<int32_t>(local % size), origin.y + static_cast<int32_t>(local / size)};
+        nodes.push_back(GraphNode{coord.x, coord.y, terrain.heightAt(coord)});
+        tile_offsets[tile + 1]++;
+    }
+    for (size_t t = 0; t < terrain.getTileCount(); ++t) {
+        tile_offsets[t + 1] += tile_offsets[t];
+    }
+    auto nodeId = [&](const Coordinate& c) {
+        return static_cast<uint32_t>(std::lower_bound(keys.begin(), keys.end(), key(c)) - keys.begin());
+    };
+
+    // Edges: one step across each transition, and exact in-tile distances
+    // between the nodes of each tile.
+    std::vector<std::vector<GraphEdge>> adjacency(nodes.size());
+    for (const auto& crossing : crossings) {
+        adjacency[nodeId(crossing.from)].push_back(GraphEdge{nodeId(crossing.to), 1});
+    }
+
+    std::vector<uint32_t> dist;
+    std::vector<uint32_t> queue;
+    for (uint32_t tile = 0; tile < terrain.getTileCount(); ++tile) {
+        Coordinate origin = terrain.tileOrigin(tile);
+        for (uint64_t u = tile_offsets[tile]; u < tile_offsets[tile + 1]; ++u) {
+            uint32_t local = static_cast<uint32_t>((nodes[u].y - origin.y) * size + (nodes[u].x - origin.x));
+            tileDistances(terrain, tile, local, true, dist, queue);
+            for (uint64_t v = tile_offsets[tile]; v < tile_offsets[tile + 1]; ++v) {
+                uint32_t target = static_cast<uint32_t>((nodes[v].y - origin.y) * size + (nodes[v].x - origin.x));
+                if (u != v && dist[target] != UNVISITED) {
+                    adjacency[u].push_back(GraphEdge{static_cast<uint32_t>(v), dist[target]});
+                }
+            }
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot create " + path);
+    }
+
+    GraphHeader header{};
+    std::memcpy(header.magic, GRAPH_MAGIC, sizeof(GRAPH_MAGIC));
+    header.node_count = nodes.size();
+    header.tile_count = terrain.getTileCount();
+    std::vector<uint64_t> edge_offsets(nodes.size() + 1, 0);
+    for (size_t u = 0; u < nodes.size(); ++u) {
+        edge_offsets[u + 1] = edge_offsets[u] + adjacency[u].size();
+    }
+    header.edge_count = edge_offsets.back();
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(tile_offsets.data()), tile_offsets.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(GraphNode));
+    out.write(reinterpret_cast<const char*>(edge_offsets.data()), edge_offsets.size() * sizeof(uint64_t));
+    for (const auto& edges : adjacency) {
+        out.write(reinterpret_cast<const char*>(edges.data()), edges.size() * sizeof(GraphEdge));
+    }
+
+    std::cerr << "Abstract graph: " << header.node_count << " nodes, "
+        << header.edge_count << " edges" << std::endl;
+}
+
+// Memory mapped view of a graph file written by buildGraph().
+class AbstractGraph {
+  public:
+    explicit AbstractGraph(const std::string& path) : file(path) {
+        if (file.getSize() < sizeof(GraphHeader)) {
+            throw std::runtime_error("Truncated graph file");
+        }
+        std::memcpy(&header, file.bytes(), sizeof(GraphHeader));
+        if (std::memcmp(header.magic, GRAPH_MAGIC, sizeof(GRAPH_MAGIC)) != 0) {
+            throw std::runtime_error("Not a graph file");
+        }
+
+        const uint8_t* at = file.bytes() + sizeof(GraphHeader);
+        tile_offsets = reinterpret_cast<const uint64_t*>(at);
+        at += (header.tile_count + 1) * sizeof(uint64_t);
+        nodes = reinterpret_cast<const GraphNode*>(at);
+        at += header.node_count * sizeof(GraphNode);
+        edge_offsets = reinterpret_cast<const uint64_t*>(at);
+        at += (header.node_count + 1) * sizeof(uint64_t);
+        edges = reinterpret_cast<const GraphEdge*>(at);
+        at += header.edge_count * sizeof(GraphEdge);
+        if (at > file.bytes() + file.getSize()) {
+            throw std::runtime_error("Truncated graph file");
+        }
+    }
+
+    uint32_t getNodeCount() const {
+        return static_cast<uint32_t>(header.node_count);
+    }
+
+    const GraphNode& getNode(uint32_t node) const {
+        return nodes[node];
+    }
+
+    uint32_t tileBegin(uint32_t tile) const {
+        return static_cast<uint32_t>(tile_offsets[tile]);
+    }
+
+    uint32_t tileEnd(uint32_t tile) const {
+        return static_cast<uint32_t>(tile_offsets[tile + 1]);
+    }
+
+    const GraphEdge* edgesBegin(uint32_t node) const {
+        return edges + edge_offsets[node];
+    }
+
+    const GraphEdge* edgesEnd(uint32_t node) const {
+        return edges + edge_offsets[node + 1];
+    }
+
+  private:
+    MappedFile file;
+    GraphHeader header;
+    const uint64_t* tile_offsets;
+    const GraphNode* nodes;
+    const uint64_t* edge_offsets;
+    const GraphEdge* edges;
+};
+
+struct QueryResult {
+    uint32_t abstract_steps = UNVISITED;
+    uint32_t steps = UNVISITED;
+    size_t abstract_visited = 0;
+    size_t corridor_tiles = 0;
+    size_t refined_visited = 0;
+};
+
+using OpenEntry = std::pair<uint32_t, uint32_t>;
+using OpenQueue = std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry>>;
+
+// A* on the abstract graph, with the source and target spliced in as two
+// extra nodes joined to the nodes of their own tiles. Returns the tiles the
+// route passes through.
+std::vector<uint32_t> abstractSearch(
+    const TiledTerrain& terrain,
+    const AbstractGraph& graph,
+    const Coordinate& from,
+    const Coordinate& to,
+    QueryResult& result
+) {
+    const uint32_t size = terrain.getTileSize();
+    const uint32_t source = graph.getNodeCount();
+    const uint32_t target = source + 1;
+    const uint32_t from_tile = terrain.tileOf(from);
+    const uint32_t to_tile = terrain.tileOf(to);
+    const uint8_t to_height = terrain.heightAt(to);
+
+    auto local = [&](uint32_t tile, const Coordinate& c) {
+        Coordinate origin = terrain.tileOrigin(tile);
+        return static_cast<uint32_t>((c.y - origin.y) * size + (c.x - origin.x));
+    };
+
+    // Virtual edges out of the source and into the target.
+    std::vector<uint32_t> dist;
+    std::vector<uint32_t> queue;
+    std::vector<GraphEdge> source_edges;
+    std::unordered_map<uint32_t, uint32_t> to_target;
+
+    tileDistances(terrain, from_tile, local(from_tile, from), true, dist, queue);
+    for (uint32_t v = graph.tileBegin(from_tile); v < graph.tileEnd(from_tile); ++v) {
+        uint32_t d = dist[local(from_tile, Coordinate{graph.getNode(v).x, graph.getNode(v).y})];
+        if (d != UNVISITED) {
+            source_edges.push_back(GraphEdge{v, d});
+        }
+    }
+    if (from_tile == to_tile && dist[local(to_tile, to)] != UNVISITED) {
+        source_edges.push_back(GraphEdge{target, dist[local(to_tile, to)]});
+    }
+
+    tileDistances(terrain, to_tile, local(to_tile, to), false, dist, queue);
+    for (uint32_t v = graph.tileBegin(to_tile); v < graph.tileEnd(to_tile); ++v) {
+        uint32_t d = dist[local(to_tile, Coordinate{graph.getNode(v).x, graph.getNode(v).y})];
+        if (d != UNVISITED) {
+            to_target[v] = d;
+        }
+    }
+
+    // Per-node state is only kept for nodes the search reaches.
+    std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> state;  // node -> (g, parent)
+    OpenQueue open;
+    auto h = [&](uint32_t node) {
+        if (node == source) {
+            return heuristic(from, terrain.heightAt(from), to, to_height);
+        }
+        const GraphNode& n = graph.getNode(node);
+        return heuristic(Coordinate{n.x, n.y}, static_cast<uint8_t>(n.height), to, to_height);
+    };
+    auto relax = [&](uint32_t node, uint32_t parent, uint32_t g) {
+        auto found = state.find(node);
+        if (found == state.end() || g < found->second.first) {
+            state[node] = {g, parent};
+            open.emplace(g + (node == target ? 0 : h(node)), node);
+        }
+    };
+
+    state[source] = {0, source};
+    open.emplace(h(source), source);
+    while (!open.empty()) {
+        auto [f, node] = open.top();
+        open.pop();
+        uint32_t g = state[node].first;
+        if (node != target && f != g + h(node)) {
+            continue;   // Stale entry.
+        }
+        result.abstract_visited++;
+        if (node == target) {
+            break;
+        }
+
+        if (node == source) {
+            for (const auto& edge : source_edges) {
+                relax(edge.target, node, g + edge.weight);
+            }
+            continue;
+        }
+        for (const GraphEdge* edge = graph.edgesBegin(node); edge != graph.edgesEnd(node); ++edge) {
+            relax(edge->target, node, g + edge->weight);
+        }
+        auto exit = to_target.find(node);
+        if (exit != to_target.end()) {
+            relax(target, node, g + exit->second);
+        }
+    }
+
+    std::vector<uint32_t> corridor{from_tile, to_tile};
+    auto reached = state.find(target);
+    if (reached == state.end()) {
+        return {};
+    }
+    result.abstract_steps = reached->second.first;
+    for (uint32_t node = reached->second.second; node != source; node = state[node].second) {
+        const GraphNode& n = graph.getNode(node);
+        corridor.push_back(terrain.tileOf(Coordinate{n.x, n.y}));
+    }
+    std::sort(corridor.begin(), corridor.end());
+    corridor.erase(std::unique(corridor.begin(), corridor.end()), corridor.end());
+    return corridor;
+}
+
+// Exact A* over the cells of the corridor tiles only.
+uint32_t refineSearch(
+    const TiledTerrain& terrain,
+    const std::vector<uint32_t>& corridor,
+    const Coordinate& from,
+    const Coordinate& to,
+    QueryResult& result
+) {
+    const uint32_t size = terrain.getTileSize();
+    const size_t tile_cells = static_cast<size_t>(size) * size;
+    const uint8_t to_height = terrain.heightAt(to);
+
+    // Cells are numbered by corridor slot, then local index within the tile.
+    std::unordered_map<uint32_t, uint32_t> slot;
+    for (uint32_t i = 0; i < corridor.size(); ++i) {
+        slot[corridor[i]] = i;
+    }
+    std::vector<uint32_t> g(corridor.size() * tile_cells, UNVISITED);
+
+    auto cellId = [&](const Coordinate& c) -> int64_t {
+        if (!terrain.isValidCoord(c)) {
+            return -1;
+        }
+        auto found = slot.find(terrain.tileOf(c));
+        if (found == slot.end()) {
+            return -1;
+        }
+        return static_cast<int64_t>(found->second * tile_cells + (c.y % size) * size + c.x % size);
+    };
+    auto coordOf = [&](uint32_t id) {
+        Coordinate origin = terrain.tileOrigin(corridor[id / tile_cells]);
+        uint32_t local = static_cast<uint32_t>(id % tile_cells);
+        return Coordinate{origin.x + static_cast<int32_t>(local % size), origin.y + static_cast<int32_t>(local / size)};
+    };
+
+    OpenQueue open;
+    uint32_t source = static_cast<uint32_t>(cellId(from));
+    g[source] = 0;
+    open.emplace(heuristic(from, terrain.heightAt(from), to, to_height), source);
+
+    while (!open.empty()) {
+        auto [f, id] = open.top();
+        open.pop();
+        Coordinate current = coordOf(id);
+        uint8_t height = terrain.heightAt(current);
+        if (f != g[id] + heuristic(current, height, to, to_height)) {
+            continue;   // Stale entry.
+        }
+        result.refined_visited++;
+        if (current == to) {
+            return g[id];
+        }
+
+        const Coordinate neighbors[4] = {
+            {current.x + 1, current.y}, {current.x - 1, current.y},
+            {current.x, current.y + 1}, {current.x, current.y - 1}};
+        for (const auto& next : neighbors) {
+            int64_t next_id = cellId(next);
+            uint8_t next_height = terrain.heightAt(next);
+            if (next_id < 0 || !canStep(height, next_height) || g[id] + 1 >= g[next_id]) {
+                continue;
+            }
+            g[next_id] = g[id] + 1;
+            open.emplace(g[next_id] + heuristic(next, next_height, to, to_height), static_cast<uint32_t>(next_id));
+        }
+    }
+    return UNVISITED;
+}
+
+QueryResult findRoute(
+    const TiledTerrain& terrain,
+    const AbstractGraph& graph,
+    const Coordinate& from,
+    const Coordinate& to
+) {
+    if (!terrain.isValidCoord(from) || !terrain.isValidCoord(to)) {
+        throw std::runtime_error("Query outside of map");
+    }
+
+    QueryResult result;
+    auto corridor = abstractSearch(terrain, graph, from, to, result);
+    if (corridor.empty()) {
+        return result;
+    }
+    result.corridor_tiles = corridor.size();
+    result.steps = refineSearch(terrain, corridor, from, to, result);
+    return result;
+}
+
+// Peak resident set size in kilobytes.
+long peakMemoryKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int usage(const char* name) {
+    std::cerr << "Usage: " << name << " build <file> [tile_size] < map.txt" << std::endl;
+    std::cerr << "       " << name << " query <file> [x1 y1 x2 y2]" << std::endl;
+    std::cerr << "Queries search tile by tile and may return a path longer than the shortest." << std::endl;
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        return usage(argv[0]);
+    }
+    std::string command = argv[1];
+    std::string path = argv[2];
+
+    if (command == "build") {
+        uint32_t tile_size = (argc > 3) ? static_cast<uint32_t>(std::stoul(argv[3])) : DEFAULT_TILE_SIZE;
+        if (tile_size < 2) {
+            return usage(argv[0]);
+        }
+        buildTiles(std::cin, path, tile_size);
+        TiledTerrain terrain(path);
+        buildGraph(terrain, path + ".graph");
+        return 0;
+    }
+
+    if (command == "query" && (argc == 3 || argc == 7)) {
+        TiledTerrain terrain(path);
+        AbstractGraph graph(path + ".graph");
+        Coordinate from = terrain.getStart();
+        Coordinate to = terrain.getEnd();
+        if (argc == 7) {
+            from = Coordinate{std::stoi(argv[3]), std::stoi(argv[4])};
+            to = Coordinate{std::stoi(argv[5]), std::stoi(argv[6])};
+        }
+
+        QueryResult result = findRoute(terrain, graph, from, to);
+        if (result.steps == UNVISITED) {
+            throw std::runtime_error("Could not find path");
+        }
+        // The refinement is only optimal within the corridor of tiles the
+        // abstract search picked, so the path may be longer than the shortest.
+        std::cout << "Path found: " << result.steps << " steps" << std::endl;
+        std::cerr << "Abstract estimate: " << result.abstract_steps << " steps, "
+            << result.abstract_visited << " nodes visited" << std::endl;
+        std::cerr << "Refinement: " << result.corridor_tiles << " tiles, "
+            << result.refined_visited << " cells visited" << std::endl;
+        std::cerr << "Peak memory: " << peakMemoryKB() << " KB" << std::endl;
+        return 0;
+    }
+
+    return usage(argv[0]);
+}
@@ -1,212 +1,864 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <stack>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
-enum class ElementType {
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum class Comparison {
+    EQUAL,
+    INVALID,
+    VALID,
+};
+
+// END is never stored on a tape; cursors report it past the last token.
+enum class TokenKind : uint32_t {
     INTEGER,
-    LIST,
+    OPEN,
+    CLOSE,
+    END,
 };
 
-struct Element {
-    explicit Element() : parent(nullptr), tag(ElementType::INTEGER) {}
+// One packet token packed into 32 bits: the kind in the top two bits and a
+// payload below. Integers carry their value. OPEN and CLOSE carry the token
+// distance to their matching bracket, so whole lists can be skipped.
+struct Token {
+    static constexpr uint32_t KIND_SHIFT = 30;
+    static constexpr uint32_t PAYLOAD_MASK = (1u << KIND_SHIFT) - 1;
+
+    static Token make(TokenKind kind, uint32_t payload) {
+        assert(payload <= PAYLOAD_MASK);
+        return Token{(static_cast<uint32_t>(kind) << KIND_SHIFT) | payload};
+    }
+
+    TokenKind kind() const {
+        return static_cast<TokenKind>(bits >> KIND_SHIFT);
+    }
 
-    Element* parent;
-    ElementType tag;
+    uint32_t payload() const {
+        return bits & PAYLOAD_MASK;
+    }
 
-    // These could be in a union, but avoiding complexity with non-trivial constructors.
-    size_t integer;
-    std::vector<Element> list;
+    uint32_t bits;
 };
 
-enum class Comparison {
-    EQUAL,
-    INVALID,
-    VALID,
+// A parsed packet: a view of its tokens inside an arena, plus a hash of
+// them. Structurally identical packets have identical tapes and hashes.
+struct Packet {
+    const Token* tokens;
+    uint32_t size;
+    uint64_t hash;
 };
 
-[[maybe_unused]]
-void printElement(const Element& element) {
-    switch (element.tag) {
-        case ElementType::INTEGER:
-            std::cout << element.integer;
-            break;
-        case ElementType::LIST:
-            std::cout << "[";
-            for (size_t i = 0; i < element.list.size(); ++i) {
-                printElement(element.list[i]);
-                if (i < element.list.size() - 1) {
-                    std::cout << ",";
-                }
+uint64_t hashTokens(const Token* tokens, uint32_t size) {
+    uint64_t hash = size;
+    for (uint32_t i = 0; i < size; ++i) {
+        hash = (hash ^ tokens[i].bits) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+bool isSamePacket(const Packet& left, const Packet& right) {
+    return left.hash == right.hash && left.size == right.size
+        && memcmp(left.tokens, right.tokens, left.size * sizeof(Token)) == 0;
+}
+
+// Owns the tapes of one batch of packets. Blocks are only ever appended, so
+// packets stay valid for the lifetime of the arena. Sized from the input, a
+// batch fits in a single block.
+class PacketArena {
+  public:
+    explicit PacketArena(size_t capacity_hint) : block_capacity(std::max(capacity_hint, MIN_BLOCK)) {}
+
+    Packet parse(std::string_view text) {
+        // A packet never has more tokens than characters.
+        Token* tape = reserve(text.size());
+
+        uint32_t size = 0;
+        uint32_t open = 0;
+        bool in_list = false;
+        size_t index = 0;
+        while (index < text.size()) {
+            if (size != 0 && !in_list) {
+                // The outer list has closed, or the packet began with a bare integer.
+                throw std::runtime_error("Packet must be a single list");
             }
-            std::cout << "]";
-            break;
-    }
-}
-
-Element parsePacket(const std::string& input) {
-    Element root;
-    root.tag = ElementType::LIST;
-
-    Element* current = &root;
-
-    assert(input.size() >= 2 && input[0] == '[');
-    size_t index = 1;
-    while (index < input.size()) {
-        assert(current->tag == ElementType::LIST);
-        
-        if (input[index] == '[') {
-            current->list.emplace_back();
-            Element& new_element = current->list.back();
-            new_element.parent = current;
-            new_element.tag = ElementType::LIST;
-            current = &current->list.back();
-            ++index;
-        } else if (input[index] == ']') {
-            assert(current == &root || current->parent != nullptr);
-            current = current->parent;
-            ++index;
-        } else {
-            auto end = std::min(input.find(",", index), input.find("]", index));
-            assert(end != std::string::npos);
-
-            if (index != end) {
-                size_t integer = std::stoi(input.substr(index, end - index));
-                current->list.emplace_back();
-                Element& new_element = current->list.back();
-                new_element.parent = current;
-                new_element.tag = ElementType::INTEGER;
-                new_element.integer = integer;
-                index = end;
+            char c = text[index];
+            if (c == '[') {
+                // Until its list closes, an OPEN links to the enclosing OPEN.
+                tape[size] = Token::make(TokenKind::OPEN, in_list ? size - open : 0);
+                open = size++;
+                in_list = true;
+                ++index;
+            } else if (c == ']') {
+                if (!in_list) {
+                    throw std::runtime_error("Unbalanced packet");
+                }
+                uint32_t parent_offset = tape[open].payload();
+                uint32_t skip = size - open;
+                tape[open] = Token::make(TokenKind::OPEN, skip);
+                tape[size++] = Token::make(TokenKind::CLOSE, skip);
+                in_list = parent_offset != 0;
+                open -= parent_offset;
+                ++index;
+            } else if (isdigit(c)) {
+                uint32_t integer = 0;
+                auto [end, error] = std::from_chars(text.data() + index, text.data() + text.size(), integer);
+                if (error != std::errc() || integer > Token::PAYLOAD_MASK) {
+                    throw std::runtime_error("Integer out of range in packet");
+                }
+                index = static_cast<size_t>(end - text.data());
+                tape[size++] = Token::make(TokenKind::INTEGER, integer);
+            } else if (c == ',') {
+                ++index;
+            } else {
+                throw std::runtime_error("Unexpected character in packet");
             }
+        }
+        if (in_list || size == 0 || tape[0].kind() != TokenKind::OPEN) {
+            throw std::runtime_error("Packet must be a single list");
+        }
 
-            // Skip commas.
-            if (end < input.size() && input[end] != ']') {
-                ++index;
+        used += size;
+        return Packet{tape, size, hashTokens(tape, size)};
+    }
+
+    // Gives back the space of the most recently parsed packet.
+    void release(const Packet& packet) {
+        assert(packet.tokens + packet.size == blocks.back().get() + used);
+        used -= packet.size;
+    }
+
+  private:
+    static constexpr size_t MIN_BLOCK = 1 << 12;
+
+    Token* reserve(size_t count) {
+        if (blocks.empty() || used + count > capacity) {
+            capacity = std::max(block_capacity, count);
+            blocks.push_back(std::unique_ptr<Token[]>(new Token[capacity]));
+            used = 0;
+        }
+        return blocks.back().get() + used;
+    }
+
+    size_t block_capacity;
+    std::vector<std::unique_ptr<Token[]>> blocks;
+    size_t used = 0;
+    size_t capacity = 0;
+};
+
+// Unique packets with their multiplicities, in first-seen order. Lookups go
+// through an open-addressed table of indices keyed by the packet hash.
+class PacketSet {
+  public:
+    // Adds count copies of packet. Returns false if an identical packet was
+    // already present, in which case packet itself is not kept.
+    bool insert(const Packet& packet, uint64_t count = 1) {
+        if ((packets.size() + 1) * 2 > slots.size()) {
+            grow();
+        }
+        total_count += count;
+
+        size_t slot = findSlot(packet);
+        if (slots[slot] != 0) {
+            counts[slots[slot] - 1] += count;
+            return false;
+        }
+        packets.push_back(packet);
+        counts.push_back(count);
+        slots[slot] = static_cast<uint32_t>(packets.size());
+        return true;
+    }
+
+    // Returns the index of the identical packet, or size() if there is none.
+    size_t indexOf(const Packet& packet) const {
+        if (slots.empty()) {
+            return packets.size();
+        }
+        size_t slot = findSlot(packet);
+        return slots[slot] != 0 ? slots[slot] - 1 : packets.size();
+    }
+
+    const std::vector<Packet>& getPackets() const {
+        return packets;
+    }
+
+    const std::vector<uint64_t>& getCounts() const {
+        return counts;
+    }
+
+    size_t size() const {
+        return packets.size();
+    }
+
+    uint64_t total() const {
+        return total_count;
+    }
+
+  private:
+    // Slot holding the identical packet, or the empty slot where it belongs.
+    size_t findSlot(const Packet& packet) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = packet.hash & mask;
+        while (slots[slot] != 0 && !isSamePacket(packets[slots[slot] - 1], packet)) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void grow() {
+        std::vector<uint32_t> old_slots(std::max<size_t>(16, slots.size() * 2));
+        std::swap(slots, old_slots);
+        size_t mask = slots.size() - 1;
+        for (size_t i = 0; i < packets.size(); ++i) {
+            size_t slot = packets[i].hash & mask;
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & mask;
             }
+            slots[slot] = static_cast<uint32_t>(i + 1);
         }
     }
 
-    return root;
-}
+    // Index + 1 of the packet in each slot, 0 when empty.
+    std::vector<uint32_t> slots;
+    std::vector<Packet> packets;
+    std::vector<uint64_t> counts;
+    uint64_t total_count = 0;
+};
 
 [[maybe_unused]]
-bool parsePair(std::istream& input, Element& left, Element& right) {
-    std::string line;
+void printPacket(const Packet& packet) {
+    for (uint32_t i = 0; i < packet.size; ++i) {
+        const Token& token = packet.tokens[i];
+        if (i > 0 && token.kind() != TokenKind::CLOSE && packet.tokens[i - 1].kind() != TokenKind::OPEN) {
+            std::cout << ",";
+        }
+        switch (token.kind()) {
+            case TokenKind::INTEGER:
+                std::cout << token.payload();
+                break;
+            case TokenKind::OPEN:
+                std::cout << "[";
+                break;
+            case TokenKind::CLOSE:
+                std::cout << "]";
+                break;
+            case TokenKind::END:
+                break;
+        }
+    }
+}
+
+// Walks a packet tape one token at a time. Integers compared against a list
+// are promoted in place: the cursor stays on the integer and queues the
+// closing brackets of the virtual lists wrapped around it.
+class PacketCursor {
+  public:
+    explicit PacketCursor(const Packet& packet) : token(packet.tokens), end(packet.tokens + packet.size) {}
 
-    std::getline(input, line);
-    if (line.empty()) {
-        return false;
+    TokenKind peek() const {
+        if (closing > 0) {
+            return TokenKind::CLOSE;
+        }
+        return token < end ? token->kind() : TokenKind::END;
     }
-    left = parsePacket(line);
 
-    std::getline(input, line);
-    if (line.empty()) {
-        return false;
+    uint32_t integer() const {
+        return token->payload();
     }
-    right = parsePacket(line);
 
-    // Eat blank line.
-    std::getline(input, line);
-    return true;
-}
+    // Wraps the current integer in one more list.
+    void promote() {
+        ++pending;
+    }
 
-Comparison isListValid(const std::vector<Element>& left_list, const std::vector<Element>& right_list) {
-    for (size_t i = 0; i < left_list.size(); ++i) {
-        // Left list should be same size as right, or shorter.
-        if (i >= right_list.size()) {
-            return Comparison::INVALID;
+    void advance() {
+        if (closing > 0) {
+            --closing;
+            return;
+        }
+        if (token->kind() == TokenKind::INTEGER) {
+            closing = pending;
+            pending = 0;
         }
+        ++token;
+    }
 
-        const Element& left = left_list[i];
-        const Element& right = right_list[i];
+  private:
+    const Token* token;
+    const Token* end;
+    uint32_t pending = 0;
+    uint32_t closing = 0;
+};
 
-        if (left.tag == ElementType::INTEGER && right.tag == ElementType::INTEGER) {
-            if (left.integer == right.integer) {
-                continue;
-            }
-            return left.integer < right.integer ? Comparison::VALID : Comparison::INVALID;
-        } else if (left.tag == ElementType::LIST && right.tag == ElementType::LIST) {
-            Comparison sublist_comp = isListValid(left.list, right.list);
-            if (sublist_comp == Comparison::EQUAL) {
-                continue;
+Comparison comparePackets(const Packet& left_packet, const Packet& right_packet) {
+    PacketCursor left(left_packet);
+    PacketCursor right(right_packet);
+    while (true) {
+        TokenKind left_token = left.peek();
+        TokenKind right_token = right.peek();
+
+        if (left_token == TokenKind::END || right_token == TokenKind::END) {
+            assert(left_token == right_token);
+            return Comparison::EQUAL;
+        }
+
+        if (left_token == right_token) {
+            if (left_token == TokenKind::INTEGER && left.integer() != right.integer()) {
+                return left.integer() < right.integer() ? Comparison::VALID : Comparison::INVALID;
             }
-            return sublist_comp;
+            left.advance();
+            right.advance();
+        } else if (left_token == TokenKind::CLOSE) {
+            // Left list ran out first.
+            return Comparison::VALID;
+        } else if (right_token == TokenKind::CLOSE) {
+            return Comparison::INVALID;
+        } else if (left_token == TokenKind::INTEGER) {
+            left.promote();
+            right.advance();
         } else {
-            Comparison sublist_comp = Comparison::EQUAL;
-            std::vector<Element> hoisted_list;
+            right.promote();
+            left.advance();
+        }
+    }
+}
 
-            if (left.tag == ElementType::INTEGER) {
-                hoisted_list.push_back(left);
-                sublist_comp = isListValid(hoisted_list, right.list);
-            } else {
-                hoisted_list.push_back(right);
-                sublist_comp = isListValid(left.list, hoisted_list);
+bool isPairValid(const Packet& left, const Packet& right) {
+    return comparePackets(left, right) == Comparison::VALID;
+}
+
+// Sort keys are byte strings whose memcmp order is the packet order.
+//
+// Packets are first normalised: [n], [[n]] and so on compare equal to n
+// everywhere, so they are written as the bare integer. Each element is then
+// written leaf first: the first integer or empty list reached by descending
+// through its opening brackets, followed by one OPEN byte per bracket passed.
+// Comparing an integer against a list only ever looks at that leaf, so both
+// sides line up byte for byte. The byte order is
+// CLOSE < EMPTY < integers < OPEN, and a key that ends first sorts first.
+namespace key_byte {
+    constexpr uint8_t CLOSE = 0;
+    constexpr uint8_t EMPTY = 1;
+    constexpr uint8_t SMALL_INT = 2;
+    constexpr uint32_t SMALL_LIMIT = 250;
+    constexpr uint8_t LARGE_INT = SMALL_INT + SMALL_LIMIT;
+    constexpr uint8_t OPEN = LARGE_INT + 1;
+}
+
+// Longest encoding of a single token.
+constexpr size_t MAX_KEY_BYTES_PER_TOKEN = 5;
+
+// Returns the number of brackets around the integer if the list starting at
+// tokens[0] is only an integer wrapped in singleton lists, otherwise zero.
+uint32_t wrappedIntegerDepth(const Token* tokens) {
+    uint32_t depth = 0;
+    while (tokens[depth].kind() == TokenKind::OPEN) {
+        ++depth;
+    }
+    if (tokens[depth].kind() != TokenKind::INTEGER || tokens[0].payload() != 2 * depth) {
+        return 0;
+    }
+    return depth;
+}
+
+uint8_t* encodeInteger(uint8_t* out, uint32_t integer) {
+    if (integer < key_byte::SMALL_LIMIT) {
+        *out++ = static_cast<uint8_t>(key_byte::SMALL_INT + integer);
+        return out;
+    }
+    *out++ = key_byte::LARGE_INT;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        *out++ = static_cast<uint8_t>(integer >> shift);
+    }
+    return out;
+}
+
+// Writes the sort key of a packet to out, which must have room for
+// MAX_KEY_BYTES_PER_TOKEN bytes per token. Returns the end of the key.
+uint8_t* encodeSortKey(const Packet& packet, uint8_t* out) {
+    uint32_t i = 0;
+    while (i < packet.size) {
+        if (packet.tokens[i].kind() == TokenKind::CLOSE) {
+            *out++ = key_byte::CLOSE;
+            ++i;
+            continue;
+        }
+
+        // Descend to the leaf of this element.
+        uint32_t opens = 0;
+        while (true) {
+            const Token& token = packet.tokens[i];
+            if (token.kind() == TokenKind::INTEGER) {
+                out = encodeInteger(out, token.payload());
+                ++i;
+                break;
             }
+            assert(token.kind() == TokenKind::OPEN);
+            if (uint32_t depth = wrappedIntegerDepth(packet.tokens + i)) {
+                out = encodeInteger(out, packet.tokens[i + depth].payload());
+                i += token.payload() + 1;
+                break;
+            }
+            if (token.payload() == 1) {
+                *out++ = key_byte::EMPTY;
+                i += 2;
+                break;
+            }
+            ++opens;
+            ++i;
+        }
+        out = std::fill_n(out, opens, key_byte::OPEN);
+    }
+    return out;
+}
+
+struct SortKey {
+    const uint8_t* bytes;
+    uint32_t size;
+    uint32_t index;
+};
+
+int compareKeys(const SortKey& left, const SortKey& right, size_t depth = 0) {
+    size_t common = std::min(left.size, right.size);
+    if (depth < common) {
+        int result = memcmp(left.bytes + depth, right.bytes + depth, common - depth);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return (left.size > right.size) - (left.size < right.size);
+}
+
+// Encodes every packet once into one shared buffer.
+class SortKeys {
+  public:
+    explicit SortKeys(const std::vector<Packet>& packets) {
+        size_t bound = 0;
+        for (const Packet& packet : packets) {
+            bound += packet.size * MAX_KEY_BYTES_PER_TOKEN;
+        }
+        buffer = std::make_unique<uint8_t[]>(bound);
+
+        uint8_t* out = buffer.get();
+        keys.reserve(packets.size());
+        for (uint32_t i = 0; i < packets.size(); ++i) {
+            uint8_t* end = encodeSortKey(packets[i], out);
+            keys.push_back(SortKey{out, static_cast<uint32_t>(end - out), i});
+            out = end;
+        }
+    }
+
+    std::vector<SortKey> keys;
+
+  private:
+    std::unique_ptr<uint8_t[]> buffer;
+};
+
+// Ranges this small are finished with a comparison sort.
+constexpr size_t RADIX_CUTOFF = 64;
+
+// Byte at depth, shifted up by one so that keys which already ended get
+// bucket 0 and sort first.
+inline size_t radixBucket(const SortKey& key, size_t depth) {
+    return depth < key.size ? key.bytes[depth] + 1 : 0;
+}
+
+// One MSD pass over keys[0, count) on the byte at depth. Fills bucket_end
+// with the end of every bucket.
+void radixPass(SortKey* keys, SortKey* scratch, size_t count, size_t depth, std::array<size_t, 257>& bucket_end) {
+    std::array<size_t, 257> counts{};
+    for (size_t i = 0; i < count; ++i) {
+        ++counts[radixBucket(keys[i], depth)];
+    }
+    std::array<size_t, 257> next;
+    size_t offset = 0;
+    for (size_t b = 0; b < counts.size(); ++b) {
+        next[b] = offset;
+        offset += counts[b];
+        bucket_end[b] = offset;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        scratch[next[radixBucket(keys[i], depth)]++] = keys[i];
+    }
+    std::copy(scratch, scratch + count, keys);
+}
 
-            if (sublist_comp == Comparison::EQUAL) {
-                continue;
+void radixSort(SortKey* keys, SortKey* scratch, size_t count, size_t depth) {
+    if (count < RADIX_CUTOFF) {
+        std::sort(keys, keys + count, [depth](const SortKey& left, const SortKey& right) {
+            return compareKeys(left, right, depth) < 0;
+        });
+        return;
+    }
+
+    std::array<size_t, 257> bucket_end;
+    radixPass(keys, scratch, count, depth, bucket_end);
+
+    // Bucket 0 holds keys that are fully equal.
+    for (size_t b = 1; b < bucket_end.size(); ++b) {
+        size_t begin = bucket_end[b - 1];
+        radixSort(keys + begin, scratch + begin, bucket_end[b] - begin, depth + 1);
+    }
+}
+
+// MSD radix sort split across threads. Ranges larger than an even share are
+// split with single passes until the work can be balanced, then workers take
+// the remaining ranges largest first.
+void parallelRadixSort(std::vector<SortKey>& keys, size_t threads) {
+    struct Range {
+        size_t begin;
+        size_t count;
+        size_t depth;
+    };
+
+    std::vector<SortKey> scratch(keys.size());
+    size_t share = std::max(keys.size() / (threads * 4), RADIX_CUTOFF);
+
+    std::vector<Range> ranges;
+    std::vector<Range> pending = {Range{0, keys.size(), 0}};
+    while (!pending.empty()) {
+        Range range = pending.back();
+        pending.pop_back();
+        if (range.count <= share || threads == 1) {
+            ranges.push_back(range);
+            continue;
+        }
+        std::array<size_t, 257> bucket_end;
+        radixPass(&keys[range.begin], &scratch[range.begin], range.count, range.depth, bucket_end);
+        for (size_t b = 1; b < bucket_end.size(); ++b) {
+            size_t count = bucket_end[b] - bucket_end[b - 1];
+            if (count > 1) {
+                pending.push_back(Range{range.begin + bucket_end[b - 1], count, range.depth + 1});
             }
-            return sublist_comp;
         }
     }
-    return left_list.size() == right_list.size() ? Comparison::EQUAL : Comparison::VALID;
+    std::sort(ranges.begin(), ranges.end(), [](const Range& left, const Range& right) {
+        return left.count > right.count;
+    });
+
+    std::atomic<size_t> next_range = 0;
+    auto worker = [&]() {
+        for (size_t r = next_range++; r < ranges.size(); r = next_range++) {
+            const Range& range = ranges[r];
+            radixSort(&keys[range.begin], &scratch[range.begin], range.count, range.depth);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
 }
 
-bool isPairValid(const Element& left, const Element& right) {
-    assert(left.tag == ElementType::LIST);
-    assert(right.tag == ElementType::LIST);
-    return isListValid(left.list, right.list) == Comparison::VALID;
+size_t workerCount() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
 }
 
-Element createDistressPacket(size_t distress_integer) {
-    Element num;
-    num.tag = ElementType::INTEGER;
-    num.integer = distress_integer;
+// Runs body(chunk, begin, end) over [0, count) split into one contiguous
+// chunk per thread.
+template <typename Body>
+void parallelChunks(size_t count, size_t threads, Body body) {
+    threads = std::max<size_t>(1, std::min(threads, count));
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(body, t, count * t / threads, count * (t + 1) / threads);
+    }
+    body(0, 0, count / threads);
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+}
 
-    Element inner;
-    inner.tag = ElementType::LIST;
-    inner.list.push_back(num);
+// Returns the 1-based position each probe would take if the probes were
+// added to the packets and everything sorted, counting every copy of a
+// packet. Equal packets do not push a probe back, so a probe lands on the
+// first of its equals. Each unique packet is placed among the sorted probes
+// by binary search: O(u log p) comparisons and no sort of the packets.
+std::vector<uint64_t> rankPackets(const PacketSet& set, const std::vector<Packet>& probes, size_t threads) {
+    const std::vector<Packet>& packets = set.getPackets();
+    const std::vector<uint64_t>& counts = set.getCounts();
+
+    std::vector<size_t> order(probes.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&probes](size_t left, size_t right) {
+        return isPairValid(probes[left], probes[right]);
+    });
+
+    // first_greater[j] counts the packets that sort below sorted probe j but
+    // not below sorted probe j - 1.
+    auto countChunk = [&](size_t begin, size_t end, std::vector<uint64_t>& first_greater) {
+        for (size_t i = begin; i < end; ++i) {
+            auto greater = std::partition_point(order.begin(), order.end(), [&](size_t probe) {
+                return !isPairValid(packets[i], probes[probe]);
+            });
+            first_greater[greater - order.begin()] += counts[i];
+        }
+    };
+
+    threads = std::max<size_t>(1, std::min(threads, packets.size()));
+    std::vector<std::vector<uint64_t>> chunk_counts(threads, std::vector<uint64_t>(probes.size() + 1));
+    parallelChunks(packets.size(), threads, [&](size_t chunk, size_t begin, size_t end) {
+        countChunk(begin, end, chunk_counts[chunk]);
+    });
+
+    std::vector<uint64_t> ranks(probes.size());
+    uint64_t below = 0;
+    for (size_t j = 0; j < order.size(); ++j) {
+        for (const auto& thread_counts : chunk_counts) {
+            below += thread_counts[j];
+        }
+        // Earlier probes only count when they are strictly smaller.
+        size_t first_equal = j;
+        while (first_equal > 0 && !isPairValid(probes[order[first_equal - 1]], probes[order[j]])) {
+            --first_equal;
+        }
+        ranks[order[j]] = below + first_equal + 1;
+    }
+    return ranks;
+}
 
-    Element root;
-    root.tag = ElementType::LIST;
-    root.list.push_back(inner);
+// Returns the packets at the given 1-based sorted positions, counting every
+// copy of a packet. Unique packets are split three ways around a pivot and
+// only the parts holding a requested position are split further.
+std::vector<Packet> selectPackets(const PacketSet& set, std::vector<uint64_t> positions) {
+    const std::vector<Packet>& packets = set.getPackets();
+    const std::vector<uint64_t>& counts = set.getCounts();
+
+    std::sort(positions.begin(), positions.end());
+    for (uint64_t position : positions) {
+        if (position == 0 || position > set.total()) {
+            throw std::runtime_error("Selection position out of range");
+        }
+    }
 
-    return root;
+    std::vector<uint32_t> order(packets.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    auto weight = [&](auto begin, auto end) {
+        uint64_t sum = 0;
+        for (auto it = begin; it != end; ++it) {
+            sum += counts[*it];
+        }
+        return sum;
+    };
+
+    std::vector<Packet> selected(positions.size());
+    // Positions [first, last) fall in order[begin, end), which is preceded
+    // by offset packets.
+    auto select = [&](auto& self, size_t begin, size_t end, size_t first, size_t last, uint64_t offset) -> void {
+        if (first == last) {
+            return;
+        }
+        const Packet pivot = packets[order[begin + (end - begin) / 2]];
+        auto less_end = std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t i) {
+            return isPairValid(packets[i], pivot);
+        });
+        auto equal_end = std::partition(less_end, order.begin() + end, [&](uint32_t i) {
+            return !isPairValid(pivot, packets[i]);
+        });
+        uint64_t less_weight = weight(order.begin() + begin, less_end);
+        uint64_t equal_weight = weight(less_end, equal_end);
+
+        size_t middle_first = first;
+        while (middle_first < last && positions[middle_first] - offset <= less_weight) {
+            ++middle_first;
+        }
+        size_t middle_last = middle_first;
+        while (middle_last < last && positions[middle_last] - offset <= less_weight + equal_weight) {
+            selected[middle_last++] = pivot;
+        }
+        self(self, begin, less_end - order.begin(), first, middle_first, offset);
+        self(self, equal_end - order.begin(), end, middle_last, last, offset + less_weight + equal_weight);
+    };
+    select(select, 0, order.size(), 0, positions.size(), 0);
+    return selected;
 }
 
-bool isDividerPacket(const Element& packet, const Element& divider) {
-    assert(packet.tag == ElementType::LIST);
-    assert(divider.tag == ElementType::LIST);
-    return isListValid(divider.list, packet.list) == Comparison::EQUAL;
+std::vector<uint64_t> parsePositions(const char* text) {
+    std::vector<uint64_t> positions;
+    std::string_view list = text;
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        positions.push_back(std::stoull(std::string(list.substr(0, comma))));
+        list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+    }
+    return positions;
 }
 
-int main() {
-    auto distress2 = createDistressPacket(2);
-    auto distress6 = createDistressPacket(6);
+// Input read from a file descriptor. Regular files are memory mapped;
+// anything else, such as a pipe, is read into memory.
+class MappedInput {
+  public:
+    explicit MappedInput(int fd) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            size = static_cast<size_t>(info.st_size);
+            void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                mapped = static_cast<const char*>(addr);
+                madvise(addr, size, MADV_SEQUENTIAL);
+                return;
+            }
+        }
+
+        char buffer[1 << 16];
+        ssize_t count;
+        while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+            owned.append(buffer, static_cast<size_t>(count));
+        }
+        if (count < 0) {
+            throw std::runtime_error("Cannot read input");
+        }
+    }
+
+    ~MappedInput() {
+        if (mapped != nullptr) {
+            munmap(const_cast<char*>(mapped), size);
+        }
+    }
+
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+
+    std::string_view text() const {
+        return mapped != nullptr ? std::string_view(mapped, size) : std::string_view(owned);
+    }
+
+  private:
+    const char* mapped = nullptr;
+    size_t size = 0;
+    std::string owned;
+};
+
+// Unique packets of one input, with the arenas that own them.
+struct PacketBatch {
+    std::vector<PacketArena> arenas;
+    PacketSet set;
+};
+
+// Inputs smaller than this per thread are not worth splitting.
+constexpr size_t MIN_CHUNK_BYTES = 1 << 16;
 
-    std::vector<Element> packets;
-    std::string line;
-    while (std::getline(std::cin, line)) {
+// Parses one packet per line, keeping only the first copy of each.
+void parseLines(std::string_view text, PacketArena& arena, PacketSet& set) {
+    while (!text.empty()) {
+        size_t newline = text.find('\n');
+        std::string_view line = text.substr(0, newline);
+        text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
         if (line.empty()) {
             continue;
         }
-        packets.push_back(parsePacket(line));
+        Packet packet = arena.parse(line);
+        if (!set.insert(packet)) {
+            arena.release(packet);
+        }
     }
-    packets.push_back(distress2);
-    packets.push_back(distress6);
+}
 
-    // Get divider packet indices.
-    std::sort(packets.begin(), packets.end(), isPairValid);
+// Splits the input at line starts into one chunk per thread. Each worker
+// parses and deduplicates its chunk into its own arena and set, and the sets
+// are merged in chunk order.
+PacketBatch parsePackets(std::string_view input, size_t threads) {
+    threads = std::max<size_t>(1, std::min(threads, input.size() / MIN_CHUNK_BYTES));
+
+    std::vector<size_t> bounds(threads + 1, input.size());
+    bounds[0] = 0;
+    for (size_t t = 1; t < threads; ++t) {
+        size_t newline = input.find('\n', std::max(bounds[t - 1], input.size() * t / threads));
+        bounds[t] = newline == std::string_view::npos ? input.size() : newline + 1;
+    }
 
-    size_t key = 0;
-    for (size_t i = 0; i < packets.size(); ++i) {
-        if (isDividerPacket(packets[i], distress2)) {
-            key = (i + 1);
-        } else if (isDividerPacket(packets[i], distress6)) {
-            key *= (i + 1);
-            break;
+    PacketBatch batch;
+    std::vector<PacketSet> chunk_sets(threads);
+    for (size_t t = 0; t < threads; ++t) {
+        batch.arenas.emplace_back(bounds[t + 1] - bounds[t]);
+    }
+    parallelChunks(threads, threads, [&](size_t chunk, size_t, size_t) {
+        parseLines(input.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]),
+            batch.arenas[chunk], chunk_sets[chunk]);
+    });
+
+    batch.set = std::move(chunk_sets[0]);
+    for (size_t t = 1; t < threads; ++t) {
+        const PacketSet& chunk_set = chunk_sets[t];
+        for (size_t i = 0; i < chunk_set.size(); ++i) {
+            batch.set.insert(chunk_set.getPackets()[i], chunk_set.getCounts()[i]);
+        }
+    }
+    return batch;
+}
+
+int main(int argc, char** argv) {
+    MappedInput input(STDIN_FILENO);
+    PacketBatch batch = parsePackets(input.text(), workerCount());
+    PacketSet& set = batch.set;
+
+    PacketArena divider_arena(0);
+    const Packet distress2 = divider_arena.parse("[[2]]");
+    const Packet distress6 = divider_arena.parse("[[6]]");
+
+    // Order statistics of the input packets alone.
+    if (argc > 2 && strcmp(argv[1], "--select") == 0) {
+        auto positions = parsePositions(argv[2]);
+        auto selected = selectPackets(set, positions);
+        std::sort(positions.begin(), positions.end());
+        for (size_t i = 0; i < selected.size(); ++i) {
+            std::cout << positions[i] << ": ";
+            printPacket(selected[i]);
+            std::cout << std::endl;
+        }
+        return 0;
+    }
+
+    uint64_t key = 0;
+    if (argc > 1 && strcmp(argv[1], "--sort") == 0) {
+        // Full sort of the unique packets, then find the divider packets.
+        set.insert(distress2);
+        set.insert(distress6);
+        SortKeys sort_keys(set.getPackets());
+        std::vector<SortKey>& sorted = sort_keys.keys;
+        const SortKey key2 = sorted[set.indexOf(distress2)];
+        const SortKey key6 = sorted[set.indexOf(distress6)];
+        parallelRadixSort(sorted, workerCount());
+
+        // Take the first of any equal packets, matching rankPackets().
+        uint64_t position = 1;
+        uint64_t position2 = 0;
+        uint64_t position6 = 0;
+        for (size_t i = 0; i < sorted.size() && position6 == 0; ++i) {
+            if (position2 == 0 && compareKeys(sorted[i], key2) == 0) {
+                position2 = position;
+            } else if (compareKeys(sorted[i], key6) == 0) {
+                position6 = position;
+            }
+            position += set.getCounts()[sorted[i].index];
         }
+        key = position2 * position6;
+    } else {
+        // Get divider packet indices.
+        auto ranks = rankPackets(set, {distress2, distress6}, workerCount());
+        key = ranks[0] * ranks[1];
     }
 
     std::cout << std::endl;
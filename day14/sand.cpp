@@ -1,9 +1,22 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include <unistd.h>
+
 enum class Tile : uint8_t {
     AIR,
     ROCK,
@@ -12,26 +25,424 @@ enum class Tile : uint8_t {
 };
 
 struct Coordinate {
-    size_t x;
-    size_t y;
+    int64_t x;
+    int64_t y;
+};
+
+// Square block of tiles packed at 2 bits per tile.
+struct TileChunk {
+    static constexpr int64_t SHIFT = 6;
+    static constexpr int64_t SIZE = int64_t{1} << SHIFT;
+    static constexpr int64_t MASK = SIZE - 1;
+    static constexpr size_t TILES_PER_WORD = 32;
+
+    Tile get(int64_t x, int64_t y) const {
+        size_t index = static_cast<size_t>((y << SHIFT) | x);
+        return static_cast<Tile>((words[index / TILES_PER_WORD] >> (2 * (index % TILES_PER_WORD))) & 3);
+    }
+
+    void set(int64_t x, int64_t y, Tile tile) {
+        size_t index = static_cast<size_t>((y << SHIFT) | x);
+        uint64_t& word = words[index / TILES_PER_WORD];
+        size_t shift = 2 * (index % TILES_PER_WORD);
+        word = (word & ~(uint64_t{3} << shift)) | (static_cast<uint64_t>(tile) << shift);
+    }
+
+    std::array<uint64_t, SIZE * SIZE / TILES_PER_WORD> words{};
+};
+
+// Unbounded tile map made of chunks allocated on first write. Chunks are
+// found through a directory covering the bounding box of all chunks; the
+// directory grows in any direction by copying pointers only, and tiles never
+// move once written. Unallocated tiles read as AIR.
+class TileMap {
+  public:
+    Tile get(int64_t x, int64_t y) const {
+        const TileChunk* chunk = findChunk(x >> TileChunk::SHIFT, y >> TileChunk::SHIFT);
+        return chunk != nullptr ? chunk->get(x & TileChunk::MASK, y & TileChunk::MASK) : Tile::AIR;
+    }
+
+    void set(int64_t x, int64_t y, Tile tile) {
+        chunkAt(x >> TileChunk::SHIFT, y >> TileChunk::SHIFT).set(x & TileChunk::MASK, y & TileChunk::MASK, tile);
+    }
+
+    // Decodes count tiles of row y starting at column x, a chunk at a time.
+    void readRow(int64_t x, int64_t y, size_t count, Tile* out) const {
+        while (count > 0) {
+            int64_t local_x = x & TileChunk::MASK;
+            size_t run = std::min(count, static_cast<size_t>(TileChunk::SIZE - local_x));
+            const TileChunk* chunk = findChunk(x >> TileChunk::SHIFT, y >> TileChunk::SHIFT);
+            if (chunk == nullptr) {
+                std::fill_n(out, run, Tile::AIR);
+            } else {
+                size_t index = static_cast<size_t>(((y & TileChunk::MASK) << TileChunk::SHIFT) | local_x);
+                for (size_t i = 0; i < run; ++i, ++index) {
+                    uint64_t word = chunk->words[index / TileChunk::TILES_PER_WORD];
+                    out[i] = static_cast<Tile>((word >> (2 * (index % TileChunk::TILES_PER_WORD))) & 3);
+                }
+            }
+            x += static_cast<int64_t>(run);
+            out += run;
+            count -= run;
+        }
+    }
+
+    // Empties every tile but keeps the chunks and directory for reuse.
+    void clear() {
+        for (auto& chunk : chunks) {
+            chunk->words.fill(0);
+        }
+    }
+
+  private:
+    const TileChunk* findChunk(int64_t chunk_x, int64_t chunk_y) const {
+        int64_t column = chunk_x - origin_x;
+        int64_t row = chunk_y - origin_y;
+        if (column < 0 || row < 0 || column >= columns || row >= rows) {
+            return nullptr;
+        }
+        return directory[static_cast<size_t>(row * columns + column)];
+    }
+
+    TileChunk& chunkAt(int64_t chunk_x, int64_t chunk_y) {
+        if (const TileChunk* chunk = findChunk(chunk_x, chunk_y)) {
+            return *const_cast<TileChunk*>(chunk);
+        }
+        if (chunks.empty()) {
+            origin_x = chunk_x;
+            origin_y = chunk_y;
+            columns = 1;
+            rows = 1;
+            directory.assign(1, nullptr);
+        } else if (chunk_x < origin_x || chunk_y < origin_y
+                || chunk_x >= origin_x + columns || chunk_y >= origin_y + rows) {
+            grow(chunk_x, chunk_y);
+        }
+
+        chunks.push_back(std::make_unique<TileChunk>());
+        directory[static_cast<size_t>((chunk_y - origin_y) * columns + (chunk_x - origin_x))] = chunks.back().get();
+        return *chunks.back();
+    }
+
+    // Extends the directory to cover the chunk, at least doubling along each
+    // axis that grows so that repeated growth stays cheap.
+    void grow(int64_t chunk_x, int64_t chunk_y) {
+        int64_t new_origin_x = origin_x;
+        int64_t new_origin_y = origin_y;
+        int64_t new_columns = columns;
+        int64_t new_rows = rows;
+        if (chunk_x < origin_x) {
+            new_origin_x = std::min(chunk_x, origin_x - columns);
+            new_columns += origin_x - new_origin_x;
+        } else if (chunk_x >= origin_x + columns) {
+            new_columns = std::max(chunk_x - origin_x + 1, 2 * columns);
+        }
+        if (chunk_y < origin_y) {
+            new_origin_y = std::min(chunk_y, origin_y - rows);
+            new_rows += origin_y - new_origin_y;
+        } else if (chunk_y >= origin_y + rows) {
+            new_rows = std::max(chunk_y - origin_y + 1, 2 * rows);
+        }
+
+        std::vector<TileChunk*> new_directory(static_cast<size_t>(new_columns * new_rows), nullptr);
+        for (int64_t row = 0; row < rows; ++row) {
+            for (int64_t column = 0; column < columns; ++column) {
+                int64_t new_row = row + origin_y - new_origin_y;
+                int64_t new_column = column + origin_x - new_origin_x;
+                new_directory[static_cast<size_t>(new_row * new_columns + new_column)] =
+                    directory[static_cast<size_t>(row * columns + column)];
+            }
+        }
+        directory = std::move(new_directory);
+        origin_x = new_origin_x;
+        origin_y = new_origin_y;
+        columns = new_columns;
+        rows = new_rows;
+    }
+
+    // Chunk coordinates of directory[0] and the directory extent in chunks.
+    int64_t origin_x = 0;
+    int64_t origin_y = 0;
+    int64_t columns = 0;
+    int64_t rows = 0;
+
+    std::vector<TileChunk*> directory;
+    std::vector<std::unique_ptr<TileChunk>> chunks;
+};
+
+// Inclusive tile rectangle to render.
+struct Bounds {
+    int64_t min_x;
+    int64_t max_x;
+    int64_t min_y;
+    int64_t max_y;
+
+    size_t width() const {
+        return static_cast<size_t>(max_x - min_x + 1);
+    }
+
+    size_t height() const {
+        return static_cast<size_t>(max_y - min_y + 1);
+    }
+};
+
+// Writes the whole buffer, normally in a single write(2).
+void writeAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t written = write(fd, data.data(), data.size());
+        if (written < 0) {
+            throw std::runtime_error("Cannot write output");
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+}
+
+// Frames are built in one buffer: rows are decoded a chunk at a time and
+// mapped through a per-tile lookup table.
+constexpr std::array<char, 4> TILE_CHARS = {'.', '#', '+', 'o'};
+constexpr std::array<uint8_t, 4> TILE_GREYS = {0, 96, 160, 255};
+
+std::string renderText(const TileMap& map, const Bounds& bounds) {
+    size_t width = bounds.width();
+    std::string frame(bounds.height() * (width + 1), '\n');
+    std::vector<Tile> row(width);
+    char* out = frame.data();
+    for (int64_t y = bounds.min_y; y <= bounds.max_y; ++y) {
+        map.readRow(bounds.min_x, y, width, row.data());
+        for (size_t x = 0; x < width; ++x) {
+            out[x] = TILE_CHARS[static_cast<size_t>(row[x])];
+        }
+        out += width + 1;
+    }
+    return frame;
+}
+
+// Binary greyscale image, one byte per tile.
+std::string renderPGM(const TileMap& map, const Bounds& bounds) {
+    size_t width = bounds.width();
+    std::string header = "P5\n" + std::to_string(width) + " " + std::to_string(bounds.height()) + "\n255\n";
+    std::string image(header.size() + width * bounds.height(), '\0');
+    std::copy(header.begin(), header.end(), image.begin());
+
+    std::vector<Tile> row(width);
+    uint8_t* out = reinterpret_cast<uint8_t*>(image.data() + header.size());
+    for (int64_t y = bounds.min_y; y <= bounds.max_y; ++y) {
+        map.readRow(bounds.min_x, y, width, row.data());
+        for (size_t x = 0; x < width; ++x) {
+            out[x] = TILE_GREYS[static_cast<size_t>(row[x])];
+        }
+        out += width;
+    }
+    return image;
+}
+
+// Binary bitmap, one bit per tile: set for rock and sand.
+std::string renderPBM(const TileMap& map, const Bounds& bounds) {
+    size_t width = bounds.width();
+    size_t row_bytes = (width + 7) / 8;
+    std::string header = "P4\n" + std::to_string(width) + " " + std::to_string(bounds.height()) + "\n";
+    std::string image(header.size() + row_bytes * bounds.height(), '\0');
+    std::copy(header.begin(), header.end(), image.begin());
+
+    std::vector<Tile> row(width);
+    uint8_t* out = reinterpret_cast<uint8_t*>(image.data() + header.size());
+    for (int64_t y = bounds.min_y; y <= bounds.max_y; ++y) {
+        map.readRow(bounds.min_x, y, width, row.data());
+        for (size_t x = 0; x < width; ++x) {
+            if (row[x] == Tile::ROCK || row[x] == Tile::SAND) {
+                out[x / 8] |= static_cast<uint8_t>(0x80 >> (x % 8));
+            }
+        }
+        out += row_bytes;
+    }
+    return image;
+}
+
+// Capture file of changed tiles. After the magic, each frame is the number
+// of grains at rest so far, the cave bounds as four zigzag varints, a change
+// count, and the changes. A change is delta encoded against the previous one
+// in the frame as two varints: (zigzag(dx) << 2 | tile) and zigzag(dy).
+constexpr char CAPTURE_MAGIC[8] = {'S', 'A', 'N', 'D', 'C', 'A', 'P', '2'};
+
+struct TileChange {
+    Coordinate position;
+    Tile tile;
+};
+
+class FrameWriter {
+  public:
+    FrameWriter(const std::string& path, size_t every) : out(path, std::ios::binary), every(every) {
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        assert(every > 0);
+        out.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    }
+
+    size_t getEvery() const {
+        return every;
+    }
+
+    void writeFrame(size_t grains, const Bounds& bounds, const std::vector<TileChange>& changes) {
+        buffer.clear();
+        putVarint(grains);
+        for (int64_t edge : {bounds.min_x, bounds.max_x, bounds.min_y, bounds.max_y}) {
+            putVarint(zigzag(edge));
+        }
+        putVarint(changes.size());
+        Coordinate last{0, 0};
+        for (const TileChange& change : changes) {
+            putVarint((zigzag(change.position.x - last.x) << 2) | static_cast<uint64_t>(change.tile));
+            putVarint(zigzag(change.position.y - last.y));
+            last = change.position;
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+
+  private:
+    static uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<char>(value));
+    }
+
+    std::ofstream out;
+    size_t every;
+    std::string buffer;
+};
+
+// Replays a capture file frame by frame onto a tile map.
+class FrameReader {
+  public:
+    explicit FrameReader(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        data.assign(std::istreambuf_iterator<char>(in), {});
+        if (data.size() < sizeof(CAPTURE_MAGIC) || memcmp(data.data(), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+            throw std::runtime_error("Not a capture file: " + path);
+        }
+        pos = sizeof(CAPTURE_MAGIC);
+    }
+
+    // Applies the next frame. Returns false at the end of the capture.
+    bool nextFrame(TileMap& map) {
+        if (pos >= data.size()) {
+            return false;
+        }
+        grains = getVarint();
+        for (int64_t* edge : {&bounds.min_x, &bounds.max_x, &bounds.min_y, &bounds.max_y}) {
+            *edge = unzigzag(getVarint());
+        }
+        uint64_t count = getVarint();
+        Coordinate last{0, 0};
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t packed = getVarint();
+            last.x += unzigzag(packed >> 2);
+            last.y += unzigzag(getVarint());
+            map.set(last.x, last.y, static_cast<Tile>(packed & 3));
+        }
+        return true;
+    }
+
+    size_t getGrains() const {
+        return grains;
+    }
+
+    // Cave bounds when the current frame was written.
+    const Bounds& getBounds() const {
+        return bounds;
+    }
+
+  private:
+    static int64_t unzigzag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    uint64_t getVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (pos >= data.size()) {
+                throw std::runtime_error("Truncated capture file");
+            }
+            uint8_t byte = static_cast<uint8_t>(data[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+    }
+
+    std::string data;
+    size_t pos = 0;
+    size_t grains = 0;
+    Bounds bounds{0, 0, 0, 0};
+};
+
+// Where and when a source emits grains: one every period ticks from tick
+// start on, until limit grains have come to rest (0 for no limit) or the
+// source cell is covered.
+struct SourceSchedule {
+    Coordinate position;
+    size_t start = 0;
+    size_t period = 1;
+    size_t limit = 0;
+
+    size_t nextTick(size_t tick) const {
+        if (tick <= start) {
+            return start;
+        }
+        return start + (tick - start + period - 1) / period * period;
+    }
 };
 
 class Cave {
   public:
-    Cave(size_t width, size_t height) :
-        width(width),
-        height(0),
-        max_width(501),
-        min_width(499)
+    explicit Cave(int64_t height, bool has_floor = true) :
+        initial_height(height),
+        height(height),
+        max_width(INT64_MIN),
+        min_width(INT64_MAX),
+        has_floor(has_floor)
     {
-        assert(width > 500);
         assert(height > 1);
+    }
+
+    size_t addSource(const SourceSchedule& schedule) {
+        assert(schedule.period > 0);
+        sources.push_back(SandSource{schedule, 0, true, {}});
+        placeSource(sources.back());
+        return sources.size() - 1;
+    }
 
-        addRows(height);
-        map[500] = Tile::SAND_SOURCE;
+    // Removes all rock and sand and restarts every source, keeping the
+    // sources and the tile allocations.
+    void reset() {
+        map.clear();
+        height = initial_height;
+        max_width = INT64_MIN;
+        min_width = INT64_MAX;
+        for (SandSource& source : sources) {
+            source.emitted = 0;
+            source.active = true;
+            source.path.clear();
+            placeSource(source);
+        }
     }
 
     void drawLine(Coordinate start, Coordinate end) {
+        // New rock may cut through the remembered trajectories.
+        for (SandSource& source : sources) {
+            source.path.clear();
+        }
+
         if (start.x == end.x) {             // Vertical.
             if (start.y > end.y) {
                 std::swap(start, end);
@@ -43,12 +454,10 @@ class Cave {
             if (start.x > max_width) {
                 max_width = start.x;
             }
-            if (end.y >= height) {
-                addRows(end.y - height + 2);
-            }
+            height = std::max(height, end.y + 2);
 
-            for (size_t i = start.y; i <= end.y; ++i) {
-                map[i * width + start.x] = Tile::ROCK;
+            for (int64_t i = start.y; i <= end.y; ++i) {
+                setTile(Coordinate{start.x, i}, Tile::ROCK);
             }
 
         } else if (start.y == end.y) {      // Horizontal.
@@ -62,12 +471,10 @@ class Cave {
             if (end.x > max_width) {
                 max_width = end.x;
             }
-            if (start.y >= height) {
-                addRows(start.y - height + 2);
-            }
+            height = std::max(height, start.y + 2);
 
-            for (size_t i = start.x; i <= end.x; ++i) {
-                map[start.y * width + i] = Tile::ROCK;
+            for (int64_t i = start.x; i <= end.x; ++i) {
+                setTile(Coordinate{i, start.y}, Tile::ROCK);
             }
 
         } else {
@@ -75,34 +482,109 @@ class Cave {
         }
     }
 
-    void print(std::ostream& out) const {
-        for (size_t y = 0; y < height; ++y) {
-            for (size_t x = min_width - 1; x <= max_width + 1; ++x) {
-                switch (map[y * width + x]) {
-                    case Tile::AIR:
-                        out << ".";
-                        break;
-                    case Tile::ROCK:
-                        out << "#";
-                        break;
-                    case Tile::SAND_SOURCE:
-                        out << "+";
-                        break;
-                    case Tile::SAND:
-                        out << "o";
-                        break;
+    // Every row in use, with a one tile margin either side.
+    Bounds getBounds() const {
+        return Bounds{min_width - 1, max_width + 1, 0, height - 1};
+    }
+
+    const TileMap& getMap() const {
+        return map;
+    }
+
+    void print(int fd) const {
+        writeAll(fd, renderText(map, getBounds()));
+    }
+
+    // Records every tile change from now on for frame capture. The tiles
+    // already set go into the first frame.
+    void startCapture() {
+        capturing = true;
+        changes.clear();
+        Bounds bounds = getBounds();
+        std::vector<Tile> row(bounds.width());
+        for (int64_t y = bounds.min_y; y <= bounds.max_y; ++y) {
+            map.readRow(bounds.min_x, y, row.size(), row.data());
+            for (size_t x = 0; x < row.size(); ++x) {
+                if (row[x] != Tile::AIR) {
+                    changes.push_back(TileChange{Coordinate{bounds.min_x + static_cast<int64_t>(x), y}, row[x]});
                 }
             }
-            out << std::endl;
         }
     }
 
-    bool spawnSand() {
-        Coordinate position = Coordinate{500, 0};
-        if (getTileAt(position.x, position.y) != Tile::SAND_SOURCE) {
-            return false;
+    // Emits grains from every source on its schedule until none can emit any
+    // more. Sources emitting on the same tick go in the order they were
+    // added. Returns the number of grains that came to rest.
+    //
+    // With a capture, the tiles changed since the last frame are written
+    // every capture->getEvery() grains and once more at the end.
+    size_t run(FrameWriter* capture = nullptr) {
+        if (capture != nullptr) {
+            startCapture();
+            capture->writeFrame(0, getBounds(), changes);
+            changes.clear();
         }
 
+        size_t resting = 0;
+        size_t tick = 0;
+        while (true) {
+            // Skip straight to the next tick on which some source emits.
+            size_t next = SIZE_MAX;
+            for (const SandSource& source : sources) {
+                if (source.active) {
+                    next = std::min(next, source.schedule.nextTick(tick));
+                }
+            }
+            if (next == SIZE_MAX) {
+                if (capture != nullptr && !changes.empty()) {
+                    capture->writeFrame(resting, getBounds(), changes);
+                    changes.clear();
+                }
+                capturing = false;
+                return resting;
+            }
+            tick = next;
+
+            for (size_t i = 0; i < sources.size(); ++i) {
+                SandSource& source = sources[i];
+                if (!source.active || source.schedule.nextTick(tick) != tick) {
+                    continue;
+                }
+                if (!spawnSand(i)) {
+                    source.active = false;
+                    continue;
+                }
+                ++resting;
+                if (capture != nullptr && resting % capture->getEvery() == 0) {
+                    capture->writeFrame(resting, getBounds(), changes);
+                    changes.clear();
+                }
+                if (++source.emitted == source.schedule.limit) {
+                    source.active = false;
+                }
+            }
+            ++tick;
+        }
+    }
+
+    // Each grain follows the previous grain from the same source up to the
+    // cell where that grain came to rest, so the trajectory is kept and the
+    // next grain starts from the last cell of it that is still open.
+    //
+    // The last row lies just below the lowest rock. With a floor, grains come
+    // to rest on it; without one, a grain that reaches it falls into the void
+    // and no more sand from that source comes to rest.
+    bool spawnSand(size_t index = 0) {
+        const Coordinate& origin = sources[index].schedule.position;
+        std::vector<Coordinate>& path = sources[index].path;
+        if (path.empty()) {
+            if (map.get(origin.x, origin.y) != Tile::SAND_SOURCE) {
+                return false;
+            }
+            path.push_back(origin);
+        }
+
+        Coordinate position = path.back();
         while (position.y + 1 < height) {
             if (isTileEmpty(position.x, position.y + 1)) {
                 position.y++;
@@ -121,17 +603,134 @@ class Cave {
                     max_width = position.x;
                 }
             } else {
-                map[position.y * width + position.x] = Tile::SAND;
-                return true;
+                break;
+            }
+            path.push_back(position);
+        }
+        if (!has_floor && position.y + 1 == height) {
+            return false;
+        }
+        setTile(position, Tile::SAND);
+        path.pop_back();
+
+        // Other sources' trajectories are only valid above the new grain.
+        for (size_t i = 0; i < sources.size(); ++i) {
+            if (i != index) {
+                truncatePath(sources[i].path, position);
             }
         }
-        map[position.y * width + position.x] = Tile::SAND;
         return true;
     }
 
+    // Counts the sand that comes to rest with a floor, without simulating
+    // grains. A cell fills exactly when it is not rock and it holds a source
+    // or one of the three cells above it is filled, so each row is computed
+    // as a bit set from the row above: (above | above << 1 | above >> 1) &
+    // ~rock. Sources are assumed to run until covered; limits are ignored.
+    size_t countSandWithFloor() const {
+        if (sources.empty()) {
+            return 0;
+        }
+        std::vector<Coordinate> origins;
+        for (const SandSource& source : sources) {
+            origins.push_back(source.schedule.position);
+        }
+        std::sort(origins.begin(), origins.end(), [](const Coordinate& a, const Coordinate& b) {
+            return a.y < b.y;
+        });
+
+        // Sand spreads at most one column per row.
+        int64_t top = origins.front().y;
+        int64_t left = INT64_MAX;
+        int64_t right = INT64_MIN;
+        for (const Coordinate& origin : origins) {
+            left = std::min(left, origin.x - (height - 1 - origin.y));
+            right = std::max(right, origin.x + (height - 1 - origin.y));
+        }
+        int64_t columns = right - left + 1;
+        size_t words = static_cast<size_t>(columns + 63) / 64;
+
+        std::vector<uint64_t> filled(words + 2, 0);
+        std::vector<uint64_t> next(words + 2, 0);
+        std::vector<uint64_t> rock(words + 2, 0);
+
+        // Word 0 and word words + 1 stay empty so shifts need no edge cases.
+        auto setBit = [](std::vector<uint64_t>& row, int64_t column) {
+            row[static_cast<size_t>(column / 64 + 1)] |= uint64_t{1} << (column % 64);
+        };
+        size_t count = 0;
+
+        // All rock lies between min_width and max_width.
+        int64_t first_x = std::max(left, min_width);
+        int64_t last_x = std::min(right, max_width);
+        auto origin = origins.begin();
+        for (int64_t y = top; y < height; ++y) {
+            std::fill(rock.begin(), rock.end(), 0);
+            for (int64_t x = first_x; x <= last_x; ++x) {
+                if (map.get(x, y) == Tile::ROCK) {
+                    setBit(rock, x - left);
+                }
+            }
+
+            for (size_t i = 1; i <= words; ++i) {
+                uint64_t spread = filled[i]
+                    | (filled[i] << 1) | (filled[i - 1] >> 63)
+                    | (filled[i] >> 1) | (filled[i + 1] << 63);
+                next[i] = spread & ~rock[i];
+            }
+            // A source drawn over by rock never emits.
+            for (; origin != origins.end() && origin->y == y; ++origin) {
+                if (map.get(origin->x, origin->y) != Tile::ROCK) {
+                    setBit(next, origin->x - left);
+                }
+            }
+            for (size_t i = 1; i <= words; ++i) {
+                count += static_cast<size_t>(std::popcount(next[i]));
+            }
+            std::swap(filled, next);
+        }
+        return count;
+    }
+
 private:
-    bool isTileEmpty(size_t x, size_t y) const {
-        switch (getTileAt(x, y)) {
+    struct SandSource {
+        SourceSchedule schedule;
+        size_t emitted;
+        bool active;
+
+        // Cells passed by the last grain, one per row from the source down.
+        std::vector<Coordinate> path;
+    };
+
+    void placeSource(const SandSource& source) {
+        const Coordinate& position = source.schedule.position;
+        setTile(position, Tile::SAND_SOURCE);
+        height = std::max(height, position.y + 2);
+        min_width = std::min(min_width, position.x - 1);
+        max_width = std::max(max_width, position.x + 1);
+    }
+
+    void setTile(const Coordinate& position, Tile tile) {
+        map.set(position.x, position.y, tile);
+        if (capturing) {
+            changes.push_back(TileChange{position, tile});
+        }
+    }
+
+    // A trajectory descends one row per cell, so a cell can only appear at
+    // one index of it.
+    static void truncatePath(std::vector<Coordinate>& path, const Coordinate& cell) {
+        if (path.empty() || cell.y < path.front().y) {
+            return;
+        }
+        size_t index = static_cast<size_t>(cell.y - path.front().y);
+        if (index < path.size() && path[index].x == cell.x) {
+            path.resize(index);
+        }
+    }
+
+    bool isTileEmpty(int64_t x, int64_t y) const {
+        switch (map.get(x, y)) {
             case Tile::AIR:
                 return true;
             case Tile::ROCK:
@@ -143,33 +742,29 @@ private:
         }
     }
 
-    Tile getTileAt(size_t x, size_t y) const {
-        assert(x >= 0 && x < width);
-        assert(y >= 0 && y < height);
-        return map[y * width + x];
-    }
+    // Rows in use: every rock row plus the empty row below the lowest rock.
+    int64_t initial_height;
+    int64_t height;
 
-    void addRows(size_t count) {
-        height += count;
-        map.reserve(width * height);
-        map.insert(map.end(), count * width, Tile::AIR);
-        assert(map.size() == width * height);
-    }
+    int64_t max_width;
+    int64_t min_width;
 
-    size_t width;
-    size_t height;
+    bool has_floor;
 
-    size_t max_width;
-    size_t min_width;
+    TileMap map;
 
-    std::vector<Tile> map;
+    std::vector<SandSource> sources;
+
+    // Tile changes not yet written to a capture.
+    bool capturing = false;
+    std::vector<TileChange> changes;
 };
 
 Coordinate parseCoordinate(const std::string& input) {
     size_t index = input.find(',');
     assert(index != std::string::npos);
-    size_t x = static_cast<size_t>(std::stoi(input.substr(0, index)));
-    size_t y = static_cast<size_t>(std::stoi(input.substr(index + 1)));
+    int64_t x = std::stoll(input.substr(0, index));
+    int64_t y = std::stoll(input.substr(index + 1));
     return Coordinate{x, y};
 }
 
@@ -186,10 +781,92 @@ std::vector<Coordinate> parseLine(const std::string& line) {
     return points;
 }
 
-int main() {
-    Cave cave(1024, 3);
-    std::string line;
-    while (std::getline(std::cin, line)) {
+struct Options {
+    bool has_floor = true;
+    bool sweep = false;
+    bool batch = false;
+    size_t threads = 0;
+    std::vector<SourceSchedule> sources;
+    std::string image;
+    std::string capture;
+    size_t every = 1000;
+    std::string replay;
+    size_t frame = SIZE_MAX;
+};
+
+void usage(const char* name) {
+    std::cerr << "Usage: " << name
+        << " [--void] [--sweep] [--source X,Y[,START,PERIOD,LIMIT]]..."
+        << " [--batch] [--threads N] [--image FILE.pgm|FILE.pbm]"
+        << " [--capture FILE] [--every N] < input" << std::endl;
+    std::cerr << "       " << name << " --replay FILE [--frame K]" << std::endl;
+    exit(1);
+}
+
+SourceSchedule parseSource(const char* spec, const char* name) {
+    SourceSchedule schedule;
+    long x = 0;
+    long y = 0;
+    int fields = sscanf(spec, "%ld,%ld,%zu,%zu,%zu", &x, &y, &schedule.start, &schedule.period, &schedule.limit);
+    if (fields != 2 && fields != 5) {
+        usage(name);
+    }
+    if (schedule.period == 0) {
+        usage(name);
+    }
+    schedule.position = Coordinate{x, y};
+    return schedule;
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--void") == 0) {
+            options.has_floor = false;
+        } else if (strcmp(argv[i], "--sweep") == 0) {
+            options.sweep = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            options.batch = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--source") == 0 && i + 1 < argc) {
+            options.sources.push_back(parseSource(argv[++i], argv[0]));
+        } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            options.image = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            options.capture = argv[++i];
+        } else if (strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+            options.every = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            options.replay = argv[++i];
+        } else if (strcmp(argv[i], "--frame") == 0 && i + 1 < argc) {
+            options.frame = static_cast<size_t>(std::stoul(argv[++i]));
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (options.every == 0) {
+        usage(argv[0]);
+    }
+    if (options.sources.empty()) {
+        options.sources.push_back(SourceSchedule{Coordinate{500, 0}});
+    }
+    if (options.sweep) {
+        if (!options.has_floor) {
+            usage(argv[0]);
+        }
+        for (const SourceSchedule& source : options.sources) {
+            if (source.limit != 0) {
+                throw std::runtime_error("The sweep needs sources without a grain limit");
+            }
+        }
+    }
+    return options;
+}
+
+void drawScan(Cave& cave, const std::vector<std::string>& lines) {
+    for (const std::string& line : lines) {
         auto points = parseLine(line);
         assert(points.size() >= 2);
         Coordinate start = points[0];
@@ -198,13 +875,124 @@ int main() {
             start = points[i];
         }
     }
+}
 
-    size_t counter = 0;
-    while (cave.spawnSand()) {
-        ++counter;
+size_t settle(Cave& cave, const Options& options) {
+    return options.sweep ? cave.countSandWithFloor() : cave.run();
+}
+
+// Evaluates rock scans separated by blank lines. Each worker keeps one Cave
+// and resets it between scans, so tile chunks are allocated once per worker.
+std::vector<size_t> runBatch(const std::vector<std::vector<std::string>>& scans, const Options& options) {
+    std::vector<size_t> results(scans.size());
+    std::atomic<size_t> next_scan = 0;
+    auto worker = [&]() {
+        Cave cave(3, options.has_floor);
+        for (const SourceSchedule& source : options.sources) {
+            cave.addSource(source);
+        }
+        for (size_t i = next_scan++; i < scans.size(); i = next_scan++) {
+            cave.reset();
+            drawScan(cave, scans[i]);
+            results[i] = settle(cave, options);
+        }
+    };
+
+    size_t threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(threads, scans.size()); ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
     }
+    return results;
+}
 
-    cave.print(std::cout);
+void writeImage(const std::string& path, const TileMap& map, const Bounds& bounds) {
+    bool bitmap = path.size() >= 4 && path.compare(path.size() - 4, 4, ".pbm") == 0;
+    std::string image = bitmap ? renderPBM(map, bounds) : renderPGM(map, bounds);
+    std::ofstream out(path, std::ios::binary);
+    if (!out.write(image.data(), static_cast<std::streamsize>(image.size()))) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+}
+
+// Renders one captured frame, the last by default.
+int replayCapture(const Options& options) {
+    FrameReader reader(options.replay);
+    TileMap map;
+    size_t frame = 0;
+    while (frame <= options.frame && reader.nextFrame(map)) {
+        ++frame;
+    }
+    if (frame == 0) {
+        throw std::runtime_error("Capture has no frames");
+    }
+
+    if (!options.image.empty()) {
+        writeImage(options.image, map, reader.getBounds());
+    } else {
+        writeAll(STDOUT_FILENO, renderText(map, reader.getBounds()));
+    }
+    std::cout << std::endl;
+    std::cout << "Frame " << frame - 1 << ": sand at rest: " << reader.getGrains() << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+    if (!options.replay.empty()) {
+        return replayCapture(options);
+    }
+
+    std::vector<std::vector<std::string>> scans(1);
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.empty()) {
+            if (options.batch && !scans.back().empty()) {
+                scans.emplace_back();
+            }
+            continue;
+        }
+        scans.back().push_back(line);
+    }
+    if (scans.back().empty() && scans.size() > 1) {
+        scans.pop_back();
+    }
+
+    if (options.batch) {
+        auto results = runBatch(scans, options);
+        for (size_t i = 0; i < results.size(); ++i) {
+            std::cout << "Scan " << i << ": sand at rest: " << results[i] << std::endl;
+        }
+        return 0;
+    }
+
+    Cave cave(3, options.has_floor);
+    for (const SourceSchedule& source : options.sources) {
+        cave.addSource(source);
+    }
+    drawScan(cave, scans[0]);
+
+    // Closed form, floor mode only.
+    if (options.sweep) {
+        std::cout << "Sand at rest: " << cave.countSandWithFloor() << std::endl;
+        return 0;
+    }
+
+    std::unique_ptr<FrameWriter> capture;
+    if (!options.capture.empty()) {
+        capture = std::make_unique<FrameWriter>(options.capture, options.every);
+    }
+    size_t counter = cave.run(capture.get());
+
+    if (!options.image.empty()) {
+        writeImage(options.image, cave.getMap(), cave.getBounds());
+    } else {
+        cave.print(STDOUT_FILENO);
+    }
 
     std::cout << std::endl;
     std::cout << "Sand at rest: " << counter << std::endl;
@@ -1,16 +1,35 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
 constexpr int64_t MAX_COORD = 4000000;
 
-// Quick and dirty pair hashing function.
+// Pair hash that mixes both coordinates through a 64 bit finalizer, so
+// symmetric and nearby pairs land in different buckets.
 struct HashPair {
     size_t operator()(const std::pair<int64_t, int64_t>& pair) const {
-        return pair.first ^ pair.second;
+        uint64_t hash = (static_cast<uint64_t>(pair.first) * 0x9e3779b97f4a7c15ULL)
+            ^ static_cast<uint64_t>(pair.second);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return static_cast<size_t>(hash);
     }
 };
 
@@ -29,92 +48,1284 @@ struct Bounds {
     int64_t maxY;
 };
 
+// Inclusive range of x values on one row.
+struct Interval {
+    int64_t begin;
+    int64_t end;
+};
+
 size_t manhattan_distance(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
     return static_cast<size_t>(abs(ax - bx) + abs(ay - by));
 }
 
+// Parses one "Sensor at x=.., y=..: closest beacon is at x=.., y=.." line.
+Sensor parse_sensor(const std::string& line, std::pair<int64_t, int64_t>& beacon) {
+    size_t begin;
+    size_t end;
+    begin = line.find("x=") + 2;
+    end = line.find(",", begin);
+    assert(begin < end);
+    int64_t sx = std::stoi(line.substr(begin, end - begin));
+
+    begin = line.find("y=", end) + 2;
+    end = line.find(":", begin);
+    assert(begin < end);
+    int64_t sy = std::stoi(line.substr(begin, end - begin));
+
+    begin = line.find("x=", end) + 2;
+    end = line.find(",", begin);
+    assert(begin < end);
+    int64_t bx = std::stoi(line.substr(begin, end - begin));
+
+    begin = line.find("y=", end) + 2;
+    assert(begin < line.size());
+    int64_t by = std::stoi(line.substr(begin));
+
+    beacon = std::make_pair(bx, by);
+    return Sensor(sx, sy, manhattan_distance(sx, sy, bx, by));
+}
+
 void parse_sensors(
         std::istream& input,
         std::vector<Sensor>& sensors,
         std::unordered_set<std::pair<int64_t, int64_t>, HashPair>& beacons
 ) {
     std::string line;
-    size_t begin;
-    size_t end;
+    std::pair<int64_t, int64_t> beacon;
     while (std::getline(input, line)) {
-        begin = line.find("x=") + 2;
-        end = line.find(",", begin);
-        assert(begin < end);
-        int64_t sx = std::stoi(line.substr(begin, end - begin));
-
-        begin = line.find("y=", end) + 2;
-        end = line.find(":", begin);
-        assert(begin < end);
-        int64_t sy = std::stoi(line.substr(begin, end - begin));
-
-        begin = line.find("x=", end) + 2;
-        end = line.find(",", begin);
-        assert(begin < end);
-        int64_t bx = std::stoi(line.substr(begin, end - begin));
-
-        begin = line.find("y=", end) + 2;
-        assert(begin < line.size());
-        int64_t by = std::stoi(line.substr(begin));
-
-        sensors.emplace_back(sx, sy, manhattan_distance(sx, sy, bx, by));
-        auto beacon = std::make_pair(bx, by);
+        sensors.push_back(parse_sensor(line, beacon));
         if (beacons.find(beacon) == beacons.end()) {
             beacons.insert(beacon);
         }
     }
 }
 
-void get_max_bounds(
-        std::vector<Sensor>& sensors,
-        Bounds& bounds
+// Sensors checked together in one pass of the brute force scan.
+constexpr size_t SENSOR_LANES = 8;
+
+// Rows handed to a brute force worker at a time.
+constexpr int64_t STRIPE_ROWS = 4096;
+
+// Largest coordinate or range the brute force scan accepts, so that sums of
+// two stay within its 32 bit columns.
+constexpr int64_t COLUMN_LIMIT = std::numeric_limits<int32_t>::max() / 4;
+
+// Sensors as structure of arrays, padded to a multiple of SENSOR_LANES with
+// sensors that cover nothing. 32 bit columns fit twice as many lanes in a
+// vector register as 64 bit ones.
+struct SensorColumns {
+    explicit SensorColumns(const std::vector<Sensor>& sensors) {
+        size_t padded = (sensors.size() + SENSOR_LANES - 1) / SENSOR_LANES * SENSOR_LANES;
+        x.assign(padded, 0);
+        y.assign(padded, 0);
+        range.assign(padded, -1);
+        for (size_t i = 0; i < sensors.size(); ++i) {
+            if (abs(sensors[i].x) > COLUMN_LIMIT || abs(sensors[i].y) > COLUMN_LIMIT
+                    || sensors[i].range > static_cast<size_t>(COLUMN_LIMIT)) {
+                throw std::runtime_error("Sensor out of range for the brute force scan");
+            }
+            x[i] = static_cast<int32_t>(sensors[i].x);
+            y[i] = static_cast<int32_t>(sensors[i].y);
+            range[i] = static_cast<int32_t>(sensors[i].range);
+        }
+    }
+
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<int32_t> range;
+};
+
+// Checks (px, py) against the SENSOR_LANES sensors starting at first and
+// returns the first x past every one of them that covers the point, or px if
+// none does. The loop is branch free so the compiler can vectorise it.
+int32_t skip_block(const SensorColumns& columns, size_t first, int32_t px, int32_t py) {
+    const int32_t* xs = columns.x.data() + first;
+    const int32_t* ys = columns.y.data() + first;
+    const int32_t* ranges = columns.range.data() + first;
+    int32_t ends[SENSOR_LANES];
+    for (size_t i = 0; i < SENSOR_LANES; ++i) {
+        int32_t dx = std::abs(xs[i] - px);
+        int32_t reach = ranges[i] - std::abs(ys[i] - py);
+        ends[i] = dx <= reach ? xs[i] + reach + 1 : px;
+    }
+    int32_t next = px;
+    for (size_t i = 0; i < SENSOR_LANES; ++i) {
+        next = std::max(next, ends[i]);
+    }
+    return next;
+}
+
+// First uncovered x in [min_x, max_x] on row y, or max_x + 1.
+int32_t scan_row(const SensorColumns& columns, int32_t y, int32_t min_x, int32_t max_x) {
+    int32_t x = min_x;
+    size_t block = 0;
+    size_t blocks = columns.x.size() / SENSOR_LANES;
+    // After a skip any block may cover the new x, so the scan only stops
+    // after a full round of blocks without moving.
+    for (size_t clear = 0; clear < blocks && x <= max_x;) {
+        int32_t next = skip_block(columns, block * SENSOR_LANES, x, y);
+        if (next != x) {
+            x = next;
+            clear = 0;
+        } else {
+            block = block + 1 == blocks ? 0 : block + 1;
+            ++clear;
+        }
+    }
+    return std::min(x, max_x + 1);
+}
+
+// Brute force search of the bounds, which makes no assumptions about the
+// layout of the sensors. Workers take stripes of STRIPE_ROWS rows in order,
+// and the first to find a gap stops the others.
+int64_t tuning_freq(const Bounds& bounds, const std::vector<Sensor>& sensors, size_t threads) {
+    for (int64_t edge : {bounds.minX, bounds.maxX, bounds.minY, bounds.maxY}) {
+        if (abs(edge) > COLUMN_LIMIT) {
+            throw std::runtime_error("Bounds out of range for the brute force scan");
+        }
+    }
+    SensorColumns columns(sensors);
+    int64_t stripes = (bounds.maxY - bounds.minY + STRIPE_ROWS) / STRIPE_ROWS;
+    std::atomic<int64_t> next_stripe = 0;
+    std::atomic<bool> found = false;
+    std::atomic<int64_t> freq = 0;
+
+    auto worker = [&]() {
+        for (int64_t stripe = next_stripe++; stripe < stripes && !found; stripe = next_stripe++) {
+            int64_t begin = bounds.minY + stripe * STRIPE_ROWS;
+            int64_t end = std::min(begin + STRIPE_ROWS - 1, bounds.maxY);
+            for (int64_t y = begin; y <= end && !found.load(std::memory_order_relaxed); ++y) {
+                int32_t x = scan_row(columns, static_cast<int32_t>(y),
+                    static_cast<int32_t>(bounds.minX), static_cast<int32_t>(bounds.maxX));
+                if (x <= bounds.maxX && !found.exchange(true)) {
+                    freq = (x * MAX_COORD) + y;
+                }
+            }
+        }
+    };
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(threads, static_cast<size_t>(stripes)); ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+    return freq;
+}
+
+// Each sensor covers the row segment [x - w, x + w] with w = range - |y - row|.
+// The segments are sorted and merged into disjoint intervals, in O(S log S)
+// per row. Touching intervals are merged too, so a gap is always at least one
+// cell wide.
+void row_intervals(const std::vector<Sensor>& sensors, int64_t y, std::vector<Interval>& intervals) {
+    intervals.clear();
+    for (const auto& sensor : sensors) {
+        int64_t half_width = static_cast<int64_t>(sensor.range) - abs(sensor.y - y);
+        if (half_width >= 0) {
+            intervals.push_back(Interval{sensor.x - half_width, sensor.x + half_width});
+        }
+    }
+    std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) {
+        return a.begin < b.begin;
+    });
+
+    size_t merged = 0;
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        if (merged > 0 && intervals[i].begin <= intervals[merged - 1].end + 1) {
+            intervals[merged - 1].end = std::max(intervals[merged - 1].end, intervals[i].end);
+        } else {
+            intervals[merged++] = intervals[i];
+        }
+    }
+    intervals.resize(merged);
+}
+
+// Number of cells on row y where a beacon cannot be, not counting known
+// beacons.
+size_t covered_count(
+        const std::vector<Sensor>& sensors,
+        const std::unordered_set<std::pair<int64_t, int64_t>, HashPair>& beacons,
+        int64_t y
 ) {
+    std::vector<Interval> intervals;
+    row_intervals(sensors, y, intervals);
+
+    size_t count = 0;
+    for (const auto& interval : intervals) {
+        count += static_cast<size_t>(interval.end - interval.begin + 1);
+    }
+    for (const auto& beacon : beacons) {
+        if (beacon.second != y) {
+            continue;
+        }
+        for (const auto& interval : intervals) {
+            if (beacon.first >= interval.begin && beacon.first <= interval.end) {
+                --count;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// First x in [min_x, max_x] on row y that no sensor covers, or max_x + 1 if
+// the whole range is covered. intervals is scratch space reused across rows.
+int64_t first_gap(
+        const std::vector<Sensor>& sensors,
+        int64_t y,
+        int64_t min_x,
+        int64_t max_x,
+        std::vector<Interval>& intervals
+) {
+    row_intervals(sensors, y, intervals);
+    int64_t x = min_x;
+    for (const auto& interval : intervals) {
+        if (interval.begin > x || x > max_x) {
+            break;
+        }
+        x = std::max(x, interval.end + 1);
+    }
+    return std::min(x, max_x + 1);
+}
+
+// Row by row search of the bounds with merged intervals: O(rows * S log S)
+// regardless of the width of the area.
+int64_t tuning_freq_rows(const Bounds& bounds, const std::vector<Sensor>& sensors) {
+    std::vector<Interval> intervals;
+    for (int64_t y = bounds.minY; y <= bounds.maxY; ++y) {
+        int64_t x = first_gap(sensors, y, bounds.minX, bounds.maxX, intervals);
+        if (x <= bounds.maxX) {
+            return (x * MAX_COORD) + y;
+        }
+    }
+    return 0;
+}
+
+// Uniform grid of buckets over the area the sensors cover. Each bucket lists
+// the sensors whose diamond reaches into it, so a point query only scans the
+// sensors near the point.
+class SensorGrid {
+  public:
+    explicit SensorGrid(const std::vector<Sensor>& sensors) {
+        if (sensors.empty()) {
+            return;
+        }
+        int64_t max_x = std::numeric_limits<int64_t>::min();
+        int64_t max_y = std::numeric_limits<int64_t>::min();
+        min_x = std::numeric_limits<int64_t>::max();
+        min_y = std::numeric_limits<int64_t>::max();
+        int64_t width_sum = 0;
+        for (const auto& sensor : sensors) {
+            int64_t range = static_cast<int64_t>(sensor.range);
+            min_x = std::min(min_x, sensor.x - range);
+            max_x = std::max(max_x, sensor.x + range);
+            min_y = std::min(min_y, sensor.y - range);
+            max_y = std::max(max_y, sensor.y + range);
+            width_sum += (2 * range) + 1;
+        }
+
+        // Buckets about as wide as an average diamond, so each sensor lands
+        // in a handful of them, but no more than a few buckets per sensor
+        // when the sensors are sparse.
+        int64_t count = static_cast<int64_t>(sensors.size());
+        double area = static_cast<double>(max_x - min_x + 1) * static_cast<double>(max_y - min_y + 1);
+        cell = std::max({width_sum / count, static_cast<int64_t>(std::ceil(std::sqrt(area / (4.0 * count)))),
+            int64_t(1)});
+        cols = static_cast<size_t>((max_x - min_x) / cell) + 1;
+        rows = static_cast<size_t>((max_y - min_y) / cell) + 1;
+
+        // Count the sensors per bucket, then fill the buckets in place.
+        starts.assign((rows * cols) + 1, 0);
+        for (const auto& sensor : sensors) {
+            for_each_bucket(sensor, [&](size_t bucket) {
+                ++starts[bucket + 1];
+            });
+        }
+        for (size_t bucket = 0; bucket < rows * cols; ++bucket) {
+            starts[bucket + 1] += starts[bucket];
+        }
+        entries.resize(starts.back(), Sensor(0, 0, 0));
+        std::vector<size_t> ends(starts.begin(), starts.end() - 1);
+        for (const auto& sensor : sensors) {
+            for_each_bucket(sensor, [&](size_t bucket) {
+                entries[ends[bucket]++] = sensor;
+            });
+        }
+
+        // Large sensors first, as they are the likeliest to cover a point.
+        for (size_t bucket = 0; bucket < rows * cols; ++bucket) {
+            std::sort(entries.begin() + starts[bucket], entries.begin() + starts[bucket + 1],
+                [](const Sensor& a, const Sensor& b) {
+                    return a.range > b.range;
+                });
+        }
+    }
+
+    bool is_covered(int64_t x, int64_t y) const {
+        if (x < min_x || y < min_y) {
+            return false;
+        }
+        size_t col = static_cast<size_t>((x - min_x) / cell);
+        size_t row = static_cast<size_t>((y - min_y) / cell);
+        if (col >= cols || row >= rows) {
+            return false;
+        }
+        size_t bucket = (row * cols) + col;
+        for (size_t i = starts[bucket]; i < starts[bucket + 1]; ++i) {
+            const Sensor& sensor = entries[i];
+            if (manhattan_distance(x, y, sensor.x, sensor.y) <= sensor.range) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    // Calls visit with every bucket the diamond of the sensor reaches.
+    template<typename Visit>
+    void for_each_bucket(const Sensor& sensor, Visit&& visit) const {
+        int64_t range = static_cast<int64_t>(sensor.range);
+        size_t row0 = static_cast<size_t>((sensor.y - range - min_y) / cell);
+        size_t row1 = static_cast<size_t>((sensor.y + range - min_y) / cell);
+        for (size_t row = row0; row <= row1; ++row) {
+            // The diamond is widest on the row of the bucket nearest the
+            // sensor.
+            int64_t top = min_y + (static_cast<int64_t>(row) * cell);
+            int64_t nearest = std::clamp(sensor.y, top, top + cell - 1);
+            int64_t half_width = range - abs(sensor.y - nearest);
+            size_t col0 = static_cast<size_t>((sensor.x - half_width - min_x) / cell);
+            size_t col1 = static_cast<size_t>((sensor.x + half_width - min_x) / cell);
+            for (size_t col = col0; col <= col1; ++col) {
+                visit((row * cols) + col);
+            }
+        }
+    }
+
+    int64_t min_x = 0;
+    int64_t min_y = 0;
+    int64_t cell = 1;
+    size_t cols = 0;
+    size_t rows = 0;
+    std::vector<size_t> starts = {0};
+    std::vector<Sensor> entries;
+};
+
+// Sorted, deduplicated copy.
+std::vector<int64_t> unique_values(std::vector<int64_t> values) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    return values;
+}
+
+// Tests every intersection of a line x + y = sum with a line x - y = diff
+// inside the bounds. Lines of different parity cross between cells, and then
+// the four cells around the crossing are tested instead. Returns the first
+// uncovered cell, or 0 if none is.
+int64_t search_intersections(
+        const Bounds& bounds,
+        const SensorGrid& grid,
+        const std::vector<int64_t>& sums,
+        const std::vector<int64_t>& diffs
+) {
+    for (int64_t sum : sums) {
+        for (int64_t diff : diffs) {
+            int64_t odd = (sum + diff) & 1;
+            int64_t x0 = (sum + diff) >> 1;
+            int64_t y0 = (sum - diff) >> 1;
+            for (int64_t x = x0; x <= x0 + odd; ++x) {
+                for (int64_t y = y0; y <= y0 + odd; ++y) {
+                    if (x < bounds.minX || x > bounds.maxX || y < bounds.minY || y > bounds.maxY) {
+                        continue;
+                    }
+                    if (!grid.is_covered(x, y)) {
+                        return (x * MAX_COORD) + y;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Tests where each line meets the edges of the bounds, and the corners.
+// Returns the first uncovered point, or 0 if none is.
+int64_t search_edges(
+        const Bounds& bounds,
+        const SensorGrid& grid,
+        const std::vector<int64_t>& sums,
+        const std::vector<int64_t>& diffs
+) {
+    std::vector<std::pair<int64_t, int64_t>> points = {
+        {bounds.minX, bounds.minY}, {bounds.minX, bounds.maxY},
+        {bounds.maxX, bounds.minY}, {bounds.maxX, bounds.maxY},
+    };
+    for (int64_t sum : sums) {
+        points.emplace_back(bounds.minX, sum - bounds.minX);
+        points.emplace_back(bounds.maxX, sum - bounds.maxX);
+        points.emplace_back(sum - bounds.minY, bounds.minY);
+        points.emplace_back(sum - bounds.maxY, bounds.maxY);
+    }
+    for (int64_t diff : diffs) {
+        points.emplace_back(bounds.minX, bounds.minX - diff);
+        points.emplace_back(bounds.maxX, bounds.maxX - diff);
+        points.emplace_back(diff + bounds.minY, bounds.minY);
+        points.emplace_back(diff + bounds.maxY, bounds.maxY);
+    }
+    for (const auto& [x, y] : points) {
+        if (x < bounds.minX || x > bounds.maxX || y < bounds.minY || y > bounds.maxY) {
+            continue;
+        }
+        if (!grid.is_covered(x, y)) {
+            return (x * MAX_COORD) + y;
+        }
+    }
+    return 0;
+}
+
+// A single uncovered cell lies just outside the diamonds that surround it,
+// next to the lines x + y = sx + sy +- (range + 1) and
+// x - y = sx - sy +- (range + 1). It is usually on two of them, but it can
+// also sit on one line and one cell past another, so the cells around
+// crossings of opposite parity are tested too.
+//
+// Usually the cell sits in a one cell wide channel between sensors whose
+// perimeters coincide, and only those shared lines are tried first. If that
+// fails, every perimeter line is tried, then where those lines meet the
+// edges of the area, which covers a cell pinned against an edge. Any layout
+// those miss falls back to the row search, so a gap is never reported as 0.
+int64_t tuning_freq_perimeter(const Bounds& bounds, const std::vector<Sensor>& sensors) {
+    SensorGrid grid(sensors);
+    std::vector<int64_t> sums;
+    std::vector<int64_t> diffs;
+    for (size_t i = 0; i < sensors.size(); ++i) {
+        const Sensor& a = sensors[i];
+        for (size_t j = i + 1; j < sensors.size(); ++j) {
+            const Sensor& b = sensors[j];
+            if (manhattan_distance(a.x, a.y, b.x, b.y) != a.range + b.range + 2) {
+                continue;
+            }
+            int64_t gap = static_cast<int64_t>(a.range) + 1;
+            // The channel runs along x + y when the sensors are offset
+            // diagonally the same way in x and y, and along x - y otherwise.
+            if ((b.x - a.x) * (b.y - a.y) >= 0) {
+                sums.push_back(a.x + a.y + (b.x + b.y > a.x + a.y ? gap : -gap));
+            } else {
+                diffs.push_back(a.x - a.y + (b.x - b.y > a.x - a.y ? gap : -gap));
+            }
+        }
+    }
+    int64_t freq = search_intersections(bounds, grid, unique_values(sums), unique_values(diffs));
+    if (freq != 0) {
+        return freq;
+    }
+
+    sums.clear();
+    diffs.clear();
     for (const auto& sensor : sensors) {
-        if (sensor.x > bounds.maxX) {
-            bounds.maxX = sensor.x;
+        int64_t gap = static_cast<int64_t>(sensor.range) + 1;
+        sums.push_back(sensor.x + sensor.y - gap);
+        sums.push_back(sensor.x + sensor.y + gap);
+        diffs.push_back(sensor.x - sensor.y - gap);
+        diffs.push_back(sensor.x - sensor.y + gap);
+    }
+    sums = unique_values(sums);
+    diffs = unique_values(diffs);
+    freq = search_intersections(bounds, grid, sums, diffs);
+    if (freq != 0) {
+        return freq;
+    }
+    freq = search_edges(bounds, grid, sums, diffs);
+    if (freq != 0) {
+        return freq;
+    }
+    return tuning_freq_rows(bounds, sensors);
+}
+
+// Inclusive rectangle on an integer grid.
+struct Rect {
+    int64_t u0;
+    int64_t u1;
+    int64_t v0;
+    int64_t v1;
+};
+
+// Union of rectangles as a sweep over u. A segment tree over the compressed v
+// edges holds how many rectangles cover each v range, and every u edge where
+// a rectangle starts or ends gets its own version of the tree. Versions share
+// the nodes they do not change, so the sweep takes O(R log R) nodes for R
+// rectangles.
+//
+// A point query costs O(log R). Area and gap queries cost O(log R) for each
+// slab between consecutive u edges that the region crosses, plus O(log R) per
+// gap found; an area query spanning every v edge only looks at its end slabs.
+class RectUnion {
+  public:
+    explicit RectUnion(const std::vector<Rect>& rects) {
+        us = {-FAR, FAR};
+        vs = {-FAR, FAR};
+        for (const Rect& rect : rects) {
+            if (rect.u0 > rect.u1 || rect.v0 > rect.v1) {
+                continue;
+            }
+            us.push_back(rect.u0);
+            us.push_back(rect.u1 + 1);
+            vs.push_back(rect.v0);
+            vs.push_back(rect.v1 + 1);
         }
-        if (sensor.y > bounds.maxY) {
-            bounds.maxY = sensor.y;
+        us = unique_values(std::move(us));
+        vs = unique_values(std::move(vs));
+
+        struct Event {
+            int64_t u;
+            size_t v0;
+            size_t v1;
+            int32_t delta;
+        };
+        std::vector<Event> events;
+        for (const Rect& rect : rects) {
+            if (rect.u0 > rect.u1 || rect.v0 > rect.v1) {
+                continue;
+            }
+            size_t v0 = edge(vs, rect.v0);
+            size_t v1 = edge(vs, rect.v1 + 1);
+            events.push_back(Event{rect.u0, v0, v1, 1});
+            events.push_back(Event{rect.u1 + 1, v0, v1, -1});
+        }
+        std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+            return a.u < b.u;
+        });
+
+        // Node 0 is the empty tree that every version starts from.
+        nodes.push_back(Node{});
+        roots.assign(us.size() - 1, 0);
+        full_prefix.assign(us.size(), 0);
+        uint32_t root = 0;
+        size_t next = 0;
+        for (size_t i = 0; i + 1 < us.size(); ++i) {
+            for (; next < events.size() && events[next].u == us[i]; ++next) {
+                root = update(root, 0, vs.size() - 1, events[next].v0, events[next].v1, events[next].delta);
+            }
+            roots[i] = root;
+            int64_t covered = nodes[root].covered;
+            full_prefix[i + 1] = full_prefix[i] + (covered != 0 ? covered * (us[i + 1] - us[i]) : 0);
         }
     }
+
+    bool contains(int64_t u, int64_t v) const {
+        if (u < -FAR || u >= FAR || v < -FAR || v >= FAR) {
+            return false;
+        }
+        size_t j = cell(vs, v);
+        uint32_t node = roots[cell(us, u)];
+        size_t lo = 0;
+        size_t hi = vs.size() - 1;
+        while (nodes[node].count == 0) {
+            if (nodes[node].covered == 0) {
+                return false;
+            }
+            size_t mid = (lo + hi) / 2;
+            if (j < mid) {
+                node = nodes[node].left;
+                hi = mid;
+            } else {
+                node = nodes[node].right;
+                lo = mid;
+            }
+        }
+        return true;
+    }
+
+    int64_t area(const Rect& region) const {
+        Rect clipped = clip(region);
+        if (clipped.u0 > clipped.u1 || clipped.v0 > clipped.v1) {
+            return 0;
+        }
+        // Nothing is covered outside the inner v edges, so a region spanning
+        // them can use the covered total of each slab.
+        bool full = clipped.v0 <= vs[1] && clipped.v1 + 1 >= vs[vs.size() - 2];
+        auto slab_area = [&](size_t i) {
+            int64_t width = std::min(us[i + 1] - 1, clipped.u1) - std::max(us[i], clipped.u0) + 1;
+            int64_t length = full ? nodes[roots[i]].covered
+                : covered_length(roots[i], 0, vs.size() - 1, clipped.v0, clipped.v1 + 1);
+            return length != 0 ? width * length : 0;
+        };
+
+        size_t first = cell(us, clipped.u0);
+        size_t last = cell(us, clipped.u1);
+        if (first == last) {
+            return slab_area(first);
+        }
+        int64_t total = slab_area(first) + slab_area(last);
+        if (full) {
+            return total + full_prefix[last] - full_prefix[first + 1];
+        }
+        for (size_t i = first + 1; i < last; ++i) {
+            total += slab_area(i);
+        }
+        return total;
+    }
+
+    // Calls visit with maximal uncovered v runs of each slab in the region,
+    // as rectangles, until it returns false. span(u0, u1) narrows the v range
+    // searched for the slab part with u in [u0, u1].
+    template<typename Span, typename Visit>
+    void for_each_gap(const Rect& region, Span&& span, Visit&& visit) const {
+        Rect clipped = clip(region);
+        if (clipped.u0 > clipped.u1 || clipped.v0 > clipped.v1) {
+            return;
+        }
+        for (size_t i = cell(us, clipped.u0); i <= cell(us, clipped.u1); ++i) {
+            int64_t u0 = std::max(us[i], clipped.u0);
+            int64_t u1 = std::min(us[i + 1] - 1, clipped.u1);
+            auto [v0, v1] = span(u0, u1);
+            v0 = std::max(v0, clipped.v0);
+            v1 = std::min(v1, clipped.v1);
+            if (v0 > v1) {
+                continue;
+            }
+
+            // Adjacent gaps from neighbouring nodes are joined into one run.
+            bool open = false;
+            Rect run{u0, u1, 0, 0};
+            auto emit = [&](int64_t begin, int64_t end) {
+                if (open && run.v1 + 1 == begin) {
+                    run.v1 = end;
+                    return true;
+                }
+                bool keep_going = !open || visit(run);
+                open = true;
+                run.v0 = begin;
+                run.v1 = end;
+                return keep_going;
+            };
+            bool more = gaps(roots[i], 0, vs.size() - 1, v0, v1 + 1, emit);
+            if (!more || (open && !visit(run))) {
+                return;
+            }
+        }
+    }
+
+  private:
+    struct Node {
+        uint32_t left = 0;
+        uint32_t right = 0;
+        int32_t count = 0;
+        // Cells of the node covered by rectangles added at it or below it.
+        int64_t covered = 0;
+    };
+
+    // Coordinates past this are never covered.
+    static constexpr int64_t FAR = int64_t(1) << 40;
+
+    static size_t edge(const std::vector<int64_t>& edges, int64_t value) {
+        return static_cast<size_t>(std::lower_bound(edges.begin(), edges.end(), value) - edges.begin());
+    }
+
+    // Compressed cell holding value, for -FAR <= value < FAR.
+    static size_t cell(const std::vector<int64_t>& edges, int64_t value) {
+        return static_cast<size_t>(std::upper_bound(edges.begin(), edges.end(), value) - edges.begin()) - 1;
+    }
+
+    static Rect clip(const Rect& region) {
+        return Rect{
+            std::max(region.u0, -FAR), std::min(region.u1, FAR - 1),
+            std::max(region.v0, -FAR), std::min(region.v1, FAR - 1),
+        };
+    }
+
+    // Copy of node with delta added over edges [a, b), for the node spanning
+    // edges [lo, hi).
+    uint32_t update(uint32_t node, size_t lo, size_t hi, size_t a, size_t b, int32_t delta) {
+        auto copy = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(nodes[node]);
+        if (a <= lo && hi <= b) {
+            nodes[copy].count += delta;
+        } else {
+            size_t mid = (lo + hi) / 2;
+            if (a < mid) {
+                uint32_t left = update(nodes[copy].left, lo, mid, a, b, delta);
+                nodes[copy].left = left;
+            }
+            if (b > mid) {
+                uint32_t right = update(nodes[copy].right, mid, hi, a, b, delta);
+                nodes[copy].right = right;
+            }
+        }
+        Node& updated = nodes[copy];
+        if (updated.count > 0) {
+            updated.covered = vs[hi] - vs[lo];
+        } else if (hi - lo > 1) {
+            updated.covered = nodes[updated.left].covered + nodes[updated.right].covered;
+        } else {
+            updated.covered = 0;
+        }
+        return copy;
+    }
+
+    // Covered cells of node within v in [a, b).
+    int64_t covered_length(uint32_t node, size_t lo, size_t hi, int64_t a, int64_t b) const {
+        const Node& n = nodes[node];
+        if (n.covered == 0 || b <= vs[lo] || a >= vs[hi]) {
+            return 0;
+        }
+        if (n.count > 0) {
+            return std::min(b, vs[hi]) - std::max(a, vs[lo]);
+        }
+        if (a <= vs[lo] && vs[hi] <= b) {
+            return n.covered;
+        }
+        size_t mid = (lo + hi) / 2;
+        return covered_length(n.left, lo, mid, a, b) + covered_length(n.right, mid, hi, a, b);
+    }
+
+    // Calls emit(begin, end) in order with the uncovered runs of node within
+    // v in [a, b), skipping fully covered subtrees. Returns false once emit
+    // does.
+    template<typename Emit>
+    bool gaps(uint32_t node, size_t lo, size_t hi, int64_t a, int64_t b, Emit& emit) const {
+        const Node& n = nodes[node];
+        if (b <= vs[lo] || a >= vs[hi] || n.count > 0 || n.covered == vs[hi] - vs[lo]) {
+            return true;
+        }
+        if (n.covered == 0) {
+            return emit(std::max(a, vs[lo]), std::min(b, vs[hi]) - 1);
+        }
+        size_t mid = (lo + hi) / 2;
+        return gaps(n.left, lo, mid, a, b, emit) && gaps(n.right, mid, hi, a, b, emit);
+    }
+
+    std::vector<int64_t> us;
+    std::vector<int64_t> vs;
+    std::vector<Node> nodes;
+
+    // Tree for each slab [us[i], us[i + 1]).
+    std::vector<uint32_t> roots;
+
+    // Covered area of the slabs before each one.
+    std::vector<int64_t> full_prefix;
+};
+
+// In rotated coordinates u = x + y, v = x - y each sensor diamond is the
+// square |u - su| <= range, |v - sv| <= range.
+//
+// Only points with u and v of the same parity are cells, so the cells are
+// split by the parity p of x + y. Halving u - p and v - p turns each half
+// into an ordinary integer lattice (k, l), where x = k + l + p, y = k - l.
+Rect rotated_square(const Sensor& sensor) {
+    int64_t range = static_cast<int64_t>(sensor.range);
+    return Rect{
+        sensor.x + sensor.y - range, sensor.x + sensor.y + range,
+        sensor.x - sensor.y - range, sensor.x - sensor.y + range,
+    };
+}
+
+Rect rotated_bounds(const Bounds& bounds) {
+    return Rect{
+        bounds.minX + bounds.minY, bounds.maxX + bounds.maxY,
+        bounds.minX - bounds.maxY, bounds.maxX - bounds.minY,
+    };
+}
+
+// Lattice points k with u = 2k + p in each range.
+Rect halve(const Rect& rotated, int64_t p) {
+    return Rect{
+        (rotated.u0 - p + 1) >> 1, (rotated.u1 - p) >> 1,
+        (rotated.v0 - p + 1) >> 1, (rotated.v1 - p) >> 1,
+    };
+}
+
+// Range of k for which some l in the lattice rectangle puts the cell inside
+// the bounds. Empty when the first value is greater than the second.
+std::pair<int64_t, int64_t> lattice_rows(const Rect& rect, int64_t p, const Bounds& bounds) {
+    return {
+        std::max({rect.u0, rect.v0 + bounds.minY, bounds.minX - p - rect.v1,
+            (bounds.minX + bounds.minY - p + 1) >> 1}),
+        std::min({rect.u1, bounds.maxX - p - rect.v0, rect.v1 + bounds.maxY,
+            (bounds.maxX + bounds.maxY - p) >> 1}),
+    };
+}
+
+// Range of l for lattice row k that puts the cell inside the bounds.
+std::pair<int64_t, int64_t> lattice_cols(const Rect& rect, int64_t p, const Bounds& bounds, int64_t k) {
+    return {
+        std::max({rect.v0, bounds.minX - p - k, k - bounds.maxY}),
+        std::min({rect.v1, bounds.maxX - p - k, k - bounds.minY}),
+    };
 }
 
-int64_t tuning_freq(const Bounds& bounds, const std::vector<Sensor>& sensors) {
-    bool found;
-    for (int64_t y = bounds.minY; y < bounds.maxY; ++y) {
-        for (int64_t x = bounds.minX; x < bounds.maxX; ++x) {
-            found = true;
-            for (const auto& sensor : sensors) {
-                if (manhattan_distance(x, y, sensor.x, sensor.y) <= sensor.range) {
-                    size_t y_dist = static_cast<size_t>(abs(sensor.y - y));
-                    int64_t x_range = sensor.range - y_dist;
-                    x = sensor.x + x_range;
-                    found = false;
+// Coverage index over both lattices, each with its own RectUnion.
+class CoverageIndex {
+  public:
+    explicit CoverageIndex(const std::vector<Sensor>& sensors)
+        : lattices{RectUnion(squares(sensors, 0)), RectUnion(squares(sensors, 1))} {}
+
+    bool is_covered(int64_t x, int64_t y) const {
+        int64_t p = (x + y) & 1;
+        return lattices[p].contains((x + y - p) >> 1, (x - y - p) >> 1);
+    }
+
+    // Covered cells with x + y in [u0, u1] and x - y in [v0, v1].
+    int64_t covered_area(const Rect& rotated) const {
+        int64_t area = 0;
+        for (int64_t p = 0; p < 2; ++p) {
+            area += lattices[p].area(halve(rotated, p));
+        }
+        return area;
+    }
+
+    // Up to limit uncovered cells inside the bounds, sorted by x then y.
+    std::vector<std::pair<int64_t, int64_t>> uncovered_cells(const Bounds& bounds, size_t limit) const {
+        std::vector<std::pair<int64_t, int64_t>> cells;
+        for (int64_t p = 0; p < 2 && cells.size() < limit; ++p) {
+            // Lattice row k holds cells in the bounds for l between
+            // max(minX - p - k, k - maxY) and min(maxX - p - k, k - minY),
+            // which are convex and concave in k, so the extremes over the
+            // rows of a slab lie at an end or where the two terms meet.
+            auto span = [&](int64_t k0, int64_t k1) {
+                int64_t lower = INT64_MAX;
+                int64_t upper = INT64_MIN;
+                int64_t low_meet = (bounds.minX - p + bounds.maxY) >> 1;
+                int64_t high_meet = (bounds.maxX - p + bounds.minY) >> 1;
+                for (int64_t k : {k0, k1, low_meet, low_meet + 1, high_meet, high_meet + 1}) {
+                    k = std::clamp(k, k0, k1);
+                    lower = std::min(lower, std::max(bounds.minX - p - k, k - bounds.maxY));
+                    upper = std::max(upper, std::min(bounds.maxX - p - k, k - bounds.minY));
+                }
+                return std::make_pair(lower, upper);
+            };
+            lattices[p].for_each_gap(halve(rotated_bounds(bounds), p), span, [&](const Rect& gap) {
+                auto [k0, k1] = lattice_rows(gap, p, bounds);
+                for (int64_t k = k0; k <= k1; ++k) {
+                    auto [l0, l1] = lattice_cols(gap, p, bounds, k);
+                    for (int64_t l = l0; l <= l1; ++l) {
+                        if (cells.size() == limit) {
+                            return false;
+                        }
+                        cells.emplace_back(k + l + p, k - l);
+                    }
+                }
+                return true;
+            });
+        }
+        std::sort(cells.begin(), cells.end());
+        return cells;
+    }
+
+  private:
+    static std::vector<Rect> squares(const std::vector<Sensor>& sensors, int64_t p) {
+        std::vector<Rect> rects;
+        for (const auto& sensor : sensors) {
+            rects.push_back(halve(rotated_square(sensor), p));
+        }
+        return rects;
+    }
+
+    std::array<RectUnion, 2> lattices;
+};
+
+// Appends the parts of a outside b, as up to four disjoint rectangles.
+void subtract_rect(const Rect& a, const Rect& b, std::vector<Rect>& pieces) {
+    if (b.u0 > a.u1 || b.u1 < a.u0 || b.v0 > a.v1 || b.v1 < a.v0) {
+        pieces.push_back(a);
+        return;
+    }
+    if (a.u0 < b.u0) {
+        pieces.push_back(Rect{a.u0, b.u0 - 1, a.v0, a.v1});
+    }
+    if (a.u1 > b.u1) {
+        pieces.push_back(Rect{b.u1 + 1, a.u1, a.v0, a.v1});
+    }
+    int64_t u0 = std::max(a.u0, b.u0);
+    int64_t u1 = std::min(a.u1, b.u1);
+    if (a.v0 < b.v0) {
+        pieces.push_back(Rect{u0, u1, a.v0, b.v0 - 1});
+    }
+    if (a.v1 > b.v1) {
+        pieces.push_back(Rect{u0, u1, b.v1 + 1, a.v1});
+    }
+}
+
+// Rectangles inside a fixed area, bucketed on a coarse grid so that overlap
+// queries only look at rectangles near the query. Ids are handed out in
+// insertion order; erased rectangles are dropped from their buckets the next
+// time a query passes over them.
+class RectGrid {
+  public:
+    explicit RectGrid(const Rect& area) : area(area) {
+        cell_u = std::max<int64_t>(1, (area.u1 - area.u0 + GRID_SIZE) / GRID_SIZE);
+        cell_v = std::max<int64_t>(1, (area.v1 - area.v0 + GRID_SIZE) / GRID_SIZE);
+        buckets.resize(GRID_SIZE * GRID_SIZE);
+    }
+
+    // Stores the part of rect inside the area.
+    size_t insert(const Rect& rect) {
+        size_t id = rects.size();
+        Rect clipped = clip(rect);
+        rects.push_back(clipped);
+        alive.push_back(true);
+        stamps.push_back(0);
+        if (clipped.u0 <= clipped.u1 && clipped.v0 <= clipped.v1) {
+            for_each_bucket(clipped, [&](std::vector<uint32_t>& bucket) {
+                bucket.push_back(static_cast<uint32_t>(id));
+            });
+            live_index.push_back(live.size());
+            live.push_back(id);
+        } else {
+            live_index.push_back(SIZE_MAX);
+        }
+        return id;
+    }
+
+    void erase(size_t id) {
+        alive[id] = false;
+        if (live_index[id] != SIZE_MAX) {
+            size_t last = live.back();
+            live[live_index[id]] = last;
+            live_index[last] = live_index[id];
+            live.pop_back();
+            live_index[id] = SIZE_MAX;
+        }
+    }
+
+    const Rect& operator[](size_t id) const {
+        return rects[id];
+    }
+
+    // Ids of the live, non-empty rectangles.
+    const std::vector<size_t>& ids() const {
+        return live;
+    }
+
+    // Ids of the live rectangles overlapping rect, each once.
+    std::vector<size_t> overlapping(const Rect& rect) {
+        std::vector<size_t> found;
+        Rect clipped = clip(rect);
+        if (clipped.u0 > clipped.u1 || clipped.v0 > clipped.v1) {
+            return found;
+        }
+        ++epoch;
+        for_each_bucket(clipped, [&](std::vector<uint32_t>& bucket) {
+            for (size_t i = 0; i < bucket.size();) {
+                uint32_t id = bucket[i];
+                if (!alive[id]) {
+                    bucket[i] = bucket.back();
+                    bucket.pop_back();
+                    continue;
+                }
+                ++i;
+                const Rect& other = rects[id];
+                if (stamps[id] != epoch && other.u0 <= clipped.u1 && other.u1 >= clipped.u0 &&
+                    other.v0 <= clipped.v1 && other.v1 >= clipped.v0) {
+                    stamps[id] = epoch;
+                    found.push_back(id);
+                }
+            }
+        });
+        return found;
+    }
+
+  private:
+    static constexpr int64_t GRID_SIZE = 64;
+
+    Rect clip(const Rect& rect) const {
+        return Rect{
+            std::max(rect.u0, area.u0), std::min(rect.u1, area.u1),
+            std::max(rect.v0, area.v0), std::min(rect.v1, area.v1),
+        };
+    }
+
+    template <typename Visit>
+    void for_each_bucket(const Rect& rect, Visit visit) {
+        int64_t i0 = (rect.u0 - area.u0) / cell_u;
+        int64_t i1 = (rect.u1 - area.u0) / cell_u;
+        int64_t j0 = (rect.v0 - area.v0) / cell_v;
+        int64_t j1 = (rect.v1 - area.v0) / cell_v;
+        for (int64_t i = i0; i <= i1; ++i) {
+            for (int64_t j = j0; j <= j1; ++j) {
+                visit(buckets[i * GRID_SIZE + j]);
+            }
+        }
+    }
+
+    Rect area;
+    int64_t cell_u;
+    int64_t cell_v;
+    std::vector<std::vector<uint32_t>> buckets;
+    std::vector<Rect> rects;
+    std::vector<bool> alive;
+    std::vector<uint64_t> stamps;
+    uint64_t epoch = 0;
+    std::vector<size_t> live;
+    std::vector<size_t> live_index;
+};
+
+// Uncovered part of the bounds under a changing set of sensors, kept as
+// disjoint lattice rectangles that each hold at least one cell inside the
+// bounds.
+//
+// Adding a sensor cuts its square out of the gaps it overlaps. Removing one
+// can only uncover cells inside its own square, so only that square minus
+// the sensors overlapping it is added back. Gaps and sensor squares sit in a
+// RectGrid per lattice, so neither touches rectangles away from the change.
+class CoverageTracker {
+  public:
+    explicit CoverageTracker(const Bounds& bounds)
+        : bounds(bounds),
+          gaps{RectGrid(halve(rotated_bounds(bounds), 0)), RectGrid(halve(rotated_bounds(bounds), 1))},
+          squares{RectGrid(halve(rotated_bounds(bounds), 0)), RectGrid(halve(rotated_bounds(bounds), 1))} {
+        for (int64_t p = 0; p < 2; ++p) {
+            add_gaps({halve(rotated_bounds(bounds), p)}, p);
+        }
+    }
+
+    // Returns an id for remove_sensor.
+    size_t add_sensor(const Sensor& sensor) {
+        for (int64_t p = 0; p < 2; ++p) {
+            Rect square = halve(rotated_square(sensor), p);
+            std::vector<Rect> pieces;
+            for (size_t id : gaps[p].overlapping(square)) {
+                subtract_rect(gaps[p][id], square, pieces);
+                gaps[p].erase(id);
+            }
+            add_gaps(pieces, p);
+            squares[p].insert(square);
+        }
+        sensors.push_back(sensor);
+        return sensors.size() - 1;
+    }
+
+    void remove_sensor(size_t id) {
+        if (id >= sensors.size() || !sensors[id]) {
+            throw std::runtime_error("No sensor " + std::to_string(id));
+        }
+        sensors[id].reset();
+        for (int64_t p = 0; p < 2; ++p) {
+            squares[p].erase(id);
+            std::vector<Rect> pieces = {squares[p][id]};
+            for (size_t other : squares[p].overlapping(squares[p][id])) {
+                std::vector<Rect> remaining;
+                for (const Rect& piece : pieces) {
+                    subtract_rect(piece, squares[p][other], remaining);
+                }
+                pieces = std::move(remaining);
+                if (pieces.empty()) {
                     break;
                 }
             }
-            if (found) {
-                return (x * MAX_COORD) + y;
+            add_gaps(pieces, p);
+        }
+    }
+
+    bool has_gap() const {
+        return !gaps[0].ids().empty() || !gaps[1].ids().empty();
+    }
+
+    // Some uncovered cell inside the bounds, if any.
+    std::optional<std::pair<int64_t, int64_t>> find_gap() const {
+        for (int64_t p = 0; p < 2; ++p) {
+            if (!gaps[p].ids().empty()) {
+                const Rect& gap = gaps[p][gaps[p].ids().front()];
+                int64_t k = lattice_rows(gap, p, bounds).first;
+                int64_t l = lattice_cols(gap, p, bounds, k).first;
+                return std::make_pair(k + l + p, k - l);
             }
         }
+        return std::nullopt;
+    }
+
+  private:
+    // Keeps the rectangles with a cell inside the bounds.
+    void add_gaps(const std::vector<Rect>& rects, int64_t p) {
+        for (const Rect& rect : rects) {
+            if (rect.u0 > rect.u1 || rect.v0 > rect.v1) {
+                continue;
+            }
+            auto [k0, k1] = lattice_rows(rect, p, bounds);
+            if (k0 <= k1) {
+                gaps[p].insert(rect);
+            }
+        }
+    }
+
+    Bounds bounds;
+    std::vector<std::optional<Sensor>> sensors;
+    std::array<RectGrid, 2> gaps;
+
+    // Square of each sensor clipped to the bounds, under the sensor's id.
+    std::array<RectGrid, 2> squares;
+};
+
+// Answers coverage queries from a file, one per line:
+//
+//   covered X Y                 1 if a sensor covers (X, Y), else 0
+//   area U0 U1 V0 V1            covered cells with x + y in [U0, U1] and
+//                               x - y in [V0, V1]
+//   gaps X0 X1 Y0 Y1 [LIMIT]    uncovered cells in the rectangle as x,y
+//
+// Point queries go through a SensorGrid, which scales to large sensor
+// fields. The CoverageIndex is only built for the first region query.
+void run_queries(const std::vector<Sensor>& sensors, const std::string& path) {
+    SensorGrid grid(sensors);
+    std::optional<CoverageIndex> index;
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream query(line);
+        std::string kind;
+        if (!(query >> kind)) {
+            continue;
+        }
+        if (kind == "covered") {
+            int64_t x;
+            int64_t y;
+            if (!(query >> x >> y)) {
+                throw std::runtime_error("Bad query: " + line);
+            }
+            std::cout << grid.is_covered(x, y) << '\n';
+        } else if (kind == "area") {
+            Rect region;
+            if (!(query >> region.u0 >> region.u1 >> region.v0 >> region.v1)) {
+                throw std::runtime_error("Bad query: " + line);
+            }
+            if (!index) {
+                index.emplace(sensors);
+            }
+            std::cout << index->covered_area(region) << '\n';
+        } else if (kind == "gaps") {
+            Bounds bounds;
+            size_t limit = 100;
+            if (!(query >> bounds.minX >> bounds.maxX >> bounds.minY >> bounds.maxY)) {
+                throw std::runtime_error("Bad query: " + line);
+            }
+            query >> limit;
+            if (!index) {
+                index.emplace(sensors);
+            }
+            const char* separator = "";
+            for (const auto& [x, y] : index->uncovered_cells(bounds, limit)) {
+                std::cout << separator << x << "," << y;
+                separator = " ";
+            }
+            std::cout << '\n';
+        } else {
+            throw std::runtime_error("Bad query: " + line);
+        }
+    }
+}
+
+// Applies sensor changes from the input, one per line: a sensor line adds a
+// sensor, numbered from 0 in the order added, and "remove ID" removes one.
+// After each change prints the tuning frequency of an uncovered cell in the
+// bounds, or "none" if every cell is covered.
+void run_stream(std::istream& input, const Bounds& bounds) {
+    CoverageTracker tracker(bounds);
+    std::string line;
+    std::pair<int64_t, int64_t> beacon;
+    while (std::getline(input, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        if (line.compare(0, 7, "remove ") == 0) {
+            tracker.remove_sensor(static_cast<size_t>(std::stoul(line.substr(7))));
+        } else {
+            tracker.add_sensor(parse_sensor(line, beacon));
+        }
+        if (auto gap = tracker.find_gap()) {
+            std::cout << (gap->first * MAX_COORD) + gap->second << '\n';
+        } else {
+            std::cout << "none\n";
+        }
     }
-    return 0;
 }
 
-int main() {
+enum class Solver {
+    ROWS,
+    BRUTE,
+    PERIMETER,
+    INDEX,
+};
+
+struct Options {
+    int64_t row = 2000000;
+    int64_t limit = MAX_COORD;
+    Solver solver = Solver::ROWS;
+    size_t threads = 0;
+    std::string queries;
+    bool stream = false;
+};
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--row") == 0 && i + 1 < argc) {
+            options.row = std::stoll(argv[++i]);
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            options.limit = std::stoll(argv[++i]);
+        } else if (strcmp(argv[i], "--brute") == 0) {
+            options.solver = Solver::BRUTE;
+        } else if (strcmp(argv[i], "--perimeter") == 0) {
+            options.solver = Solver::PERIMETER;
+        } else if (strcmp(argv[i], "--index") == 0) {
+            options.solver = Solver::INDEX;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            options.queries = argv[++i];
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            options.stream = true;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                << " [--row Y] [--max N] [--brute [--threads N] | --perimeter | --index]"
+                << " [--queries FILE | --stream] < input" << std::endl;
+            exit(1);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char** argv) {
+    Options options = parse_options(argc, argv);
+
+    if (options.stream) {
+        run_stream(std::cin, Bounds{0, options.limit, 0, options.limit});
+        return 0;
+    }
+
     std::vector<Sensor> sensors;
     std::unordered_set<std::pair<int64_t, int64_t>, HashPair> beacons;
     parse_sensors(std::cin, sensors, beacons);
 
-    Bounds bounds{0, 0, 0, 0};
-    get_max_bounds(sensors, bounds);
-    bounds.maxX = std::min(bounds.maxX, MAX_COORD);
-    bounds.maxY = std::min(bounds.maxY, MAX_COORD);
+    if (!options.queries.empty()) {
+        run_queries(sensors, options.queries);
+        return 0;
+    }
+
+    if (options.solver == Solver::INDEX) {
+        auto cells = CoverageIndex(sensors).uncovered_cells(Bounds{0, options.limit, 0, options.limit}, 1);
+        std::cout << (cells.empty() ? 0 : (cells[0].first * MAX_COORD) + cells[0].second) << std::endl;
+        return 0;
+    }
+
+    if (options.solver == Solver::PERIMETER) {
+        std::cout << tuning_freq_perimeter(Bounds{0, options.limit, 0, options.limit}, sensors) << std::endl;
+        return 0;
+    }
+
+    if (options.solver == Solver::BRUTE) {
+        std::cout << tuning_freq(Bounds{0, options.limit, 0, options.limit}, sensors, options.threads) << std::endl;
+        return 0;
+    }
 
-    std::cout << tuning_freq(bounds, sensors) << std::endl;
+    std::cout << "Covered cells on row " << options.row << ": "
+        << covered_count(sensors, beacons, options.row) << std::endl;
+    std::cout << tuning_freq_rows(Bounds{0, options.limit, 0, options.limit}, sensors) << std::endl;
     return 0;
 }
@@ -1,7 +1,10 @@
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -73,134 +76,120 @@ void parse_vertices(std::istream& in, std::unordered_map<valve_name_t, Valve>& v
     }
 }
 
-size_t lower_bound(
-        const std::unordered_map<valve_name_t, Valve>& valves,
-        const std::unordered_set<valve_name_t>& already_opened,
-        valve_name_t starting,
-        size_t minutes_left
-) {
-    size_t pressure_released = 0;
-    valve_name_t current = starting;
-
-    std::unordered_set<valve_name_t> opened;
-    for (valve_name_t name : already_opened) {
-        opened.insert(name);
-    }
+// The valves worth visiting, which are the positive flow valves plus the
+// start, with the shortest travel time in minutes between each pair.
+struct ValveGraph {
+    std::vector<size_t> flow_rates;
+    std::vector<std::vector<size_t>> distances;
+    size_t start;
+};
 
-    for (int64_t i = minutes_left; i > 1; --i) {
-        const Valve& current_valve = valves.find(current)->second;
+ValveGraph compress_graph(const std::unordered_map<valve_name_t, Valve>& valves, valve_name_t start) {
+    constexpr size_t UNREACHABLE = std::numeric_limits<size_t>::max() / 2;
 
-        if (current_valve.flow_rate > 0) {
-            opened.insert(current_valve.name);
-            pressure_released += i * current_valve.flow_rate;
-        }
+    std::vector<valve_name_t> names;
+    std::unordered_map<valve_name_t, size_t> indices;
+    for (const auto& pair : valves) {
+        indices[pair.first] = names.size();
+        names.push_back(pair.first);
+    }
+    if (indices.find(start) == indices.end()) {
+        throw std::runtime_error("No starting valve");
+    }
 
-        bool found = false;
-        size_t best_next_score = 0;
-        valve_name_t best_next_name;
-        for (valve_name_t next : current_valve.tunnels) {
-            if (opened.find(next) != opened.end()) {
-                continue;
+    // Floyd-Warshall over every valve, including the zero flow corridors.
+    size_t n = names.size();
+    std::vector<std::vector<size_t>> all(n, std::vector<size_t>(n, UNREACHABLE));
+    for (size_t i = 0; i < n; ++i) {
+        all[i][i] = 0;
+        for (valve_name_t tunnel : valves.find(names[i])->second.tunnels) {
+            auto it = indices.find(tunnel);
+            if (it != indices.end()) {
+                all[i][it->second] = 1;
             }
-            size_t next_flow_rate = valves.find(next)->second.flow_rate;
-            if (!found || next_flow_rate > best_next_score) {
-                best_next_name = next;
-                best_next_score = next_flow_rate;
-                found = true;
-            }
-        }
-        if (!found) {
-            break;
         }
-
-        // Go to next node.
-        current = best_next_name;
     }
-    
-    return pressure_released;
-}
-
-size_t upper_bound(
-        const std::unordered_map<valve_name_t, Valve>& valves,
-        const std::unordered_set<valve_name_t>& already_opened,
-        size_t minutes_left
-) {
-    std::vector<size_t> scores;
-    for (const auto& pair : valves) {
-        if (already_opened.find(pair.first) != already_opened.end()) {
-            continue;
+    for (size_t k = 0; k < n; ++k) {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                all[i][j] = std::min(all[i][j], all[i][k] + all[k][j]);
+            }
         }
-        scores.push_back(pair.second.flow_rate);
     }
-    std::sort(scores.begin(), scores.end(), std::greater<size_t>());
 
-    size_t pressure_released = 0;
-    for (int64_t i = 0; i < std::min(scores.size(), minutes_left / 2); ++i) {
-        if (scores[i] == 0) {
-            break;
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < n; ++i) {
+        if (names[i] == start || valves.find(names[i])->second.flow_rate > 0) {
+            kept.push_back(i);
         }
-        pressure_released += scores[i] * (minutes_left - i * 2);
     }
-    return pressure_released;
-}
-
-size_t search(
-    const std::unordered_map<valve_name_t, Valve>& valves,
-    const std::unordered_set<valve_name_t>& opened,
-    valve_name_t current,
-    size_t minutes_left,
-    size_t lbound
-) {
-    if (minutes_left <= 1) {
-        return 0;
-    } else if (upper_bound(valves, opened, minutes_left) < lbound) {
-        return 0;
+    if (kept.size() > 64) {
+        throw std::runtime_error("Too many valves with positive flow");
     }
-    const Valve& current_valve = valves.find(current)->second;
 
-    size_t best_score = lbound;
-
-    for (valve_name_t next : current_valve.tunnels) {
-        size_t closed_score = search(valves, opened, next, minutes_left - 1, lbound);
-        if (closed_score > best_score) {
-            best_score = closed_score;
+    ValveGraph graph;
+    graph.distances.assign(kept.size(), std::vector<size_t>(kept.size()));
+    for (size_t i = 0; i < kept.size(); ++i) {
+        graph.flow_rates.push_back(valves.find(names[kept[i]])->second.flow_rate);
+        if (names[kept[i]] == start) {
+            graph.start = i;
+        }
+        for (size_t j = 0; j < kept.size(); ++j) {
+            graph.distances[i][j] = all[kept[i]][kept[j]];
         }
     }
+    return graph;
+}
 
-    // Valve is unopened and potentially worth opening.
-    if (current_valve.flow_rate > 0 && opened.find(current) == opened.end()) {
-        std::unordered_set<valve_name_t> new_opened;
-        for (valve_name_t name : opened) {
-            new_opened.insert(name);
+// Most pressure that can still be released from a state of the walk: the
+// current valve, the minutes left and the bitmask of opened valves. Each step
+// moves straight to an unopened valve and opens it.
+size_t best_release(const ValveGraph& graph, size_t position, size_t minutes_left, uint64_t opened) {
+    size_t best = 0;
+    for (size_t next = 0; next < graph.flow_rates.size(); ++next) {
+        if (graph.flow_rates[next] == 0 || (opened & (uint64_t(1) << next)) != 0) {
+            continue;
         }
-        new_opened.insert(current);
-        size_t opening_score = (minutes_left - 1) * current_valve.flow_rate;
-        size_t new_lbound = lower_bound(valves, new_opened, current, minutes_left - 2);
-
-        for (valve_name_t next : current_valve.tunnels) {
-            size_t score = opening_score + search(valves, new_opened, next, minutes_left - 2, new_lbound);
-            if (score > best_score) {
-                best_score = score;
-            }
+        // Travel plus one minute to open the valve.
+        size_t cost = graph.distances[position][next] + 1;
+        if (cost >= minutes_left) {
+            continue;
         }
+        size_t remaining = minutes_left - cost;
+        size_t released = (graph.flow_rates[next] * remaining)
+            + best_release(graph, next, remaining, opened | (uint64_t(1) << next));
+        best = std::max(best, released);
     }
-
-    return best_score;
+    return best;
 }
 
-size_t best_path(const std::unordered_map<valve_name_t, Valve>& valves) {
-    valve_name_t starting_valve;
-    string_to_name(&starting_valve, "AA");
+struct Options {
+    size_t minutes = 30;
+};
 
-    std::unordered_set<valve_name_t> opened;
-    size_t lbound = lower_bound(valves, opened, starting_valve, 5);
-    return search(valves, opened, starting_valve, 6, lbound);
+Options parse_options(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--minutes") == 0 && i + 1 < argc) {
+            options.minutes = static_cast<size_t>(std::stoul(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--minutes N] < input" << std::endl;
+            exit(1);
+        }
+    }
+    return options;
 }
 
-int main() {
+int main(int argc, char** argv) {
+    Options options = parse_options(argc, argv);
+
     std::unordered_map<valve_name_t, Valve> valves;
     parse_vertices(std::cin, valves);
-    size_t pressure_released = best_path(valves);
+
+    valve_name_t starting_valve;
+    string_to_name(&starting_valve, "AA");
+    ValveGraph graph = compress_graph(valves, starting_valve);
+    size_t pressure_released = best_release(graph, graph.start, options.minutes, 0);
 
     std::cout << "Released pressure: " << pressure_released << std::endl;
     return 0;